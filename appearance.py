@@ -0,0 +1,310 @@
+import json
+import os
+import pathlib
+import sys
+import time
+import logging
+from logging import getLogger
+from datetime import datetime
+import arguably
+import cv2
+from cv2.typing import MatLike
+import numpy as np
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+# the signature: hue, saturation and value histograms of the moving pixels (the hue of the colored ones only), then
+# the size and the aspect ratio
+HUE_BINS = 16
+SATURATION_BINS = 4
+VALUE_BINS = 4
+SIZE = HUE_BINS + SATURATION_BINS + VALUE_BINS + 2
+# how much the shape counts next to the colors (each histogram alone is at most 2 apart in L1)
+SIZE_WEIGHT = 2.0
+ASPECT_WEIGHT = 0.5
+HUE_MIN_SATURATION = 40
+CROP_PIXELS = 48  # the long side of the crop the histograms are computed on
+# per channel: the boxes baked into the recordings are not exactly BOX_COLOR after H.264
+DRAWN_BOX_TOLERANCE = 80
+
+UNKNOWN = "unknown"
+
+
+def main():
+
+    @arguably.command
+    def enroll(
+        name: str,
+        *files: str,
+        start_second: int = 0,
+        end_second: int = 3600,
+        scale: float = 0.5,
+        max_signatures: int = 64,
+    ):
+        """
+        add the moving object of hourly recordings to the profile `name`; pick hours (or a part of them with
+        `--start-second` and `--end-second`) where only that animal or person moved
+        """
+        signatures: list[np.ndarray] = []
+        for file in files:
+            signatures += [
+                signature
+                for second, signature in signatures_of_recording(
+                    pathlib.Path(file), scale, end_second=end_second
+                )
+                if second >= start_second
+            ]
+        print(f"{len(signatures)} signatures of {name} in {len(files)} recordings")
+        if len(signatures) == 0:
+            return
+        index = AppearanceIndex()
+        index.enroll(name, signatures, max_signatures=max_signatures)
+        index.save()
+
+    @arguably.command
+    def identify(file: str, *, scale: float = 0.5):
+        """
+        print who moved at each second of an hourly recording
+        """
+        index = AppearanceIndex()
+        for second, signature in signatures_of_recording(pathlib.Path(file), scale):
+            started = time.perf_counter()
+            nearest = index.nearest(signature)
+            us = (time.perf_counter() - started) * 1e6
+            if nearest is None:
+                print(f"{second // 60:02d}:{second % 60:02d} no profiles")
+            else:
+                name, distance = nearest
+                identity = name if distance <= index.max_distance else UNKNOWN
+                print(
+                    f"{second // 60:02d}:{second % 60:02d} {identity} ({name} at {distance:.2f}, {us:.0f}us)"
+                )
+
+    @arguably.command
+    def list_profiles():
+        """
+        print the enrolled profiles
+        """
+        index = AppearanceIndex()
+        for name, signatures in index.profiles.items():
+            print(f"{name}: {len(signatures)} signatures")
+
+    @arguably.command
+    def remove(name: str):
+        """
+        delete the profile `name`
+        """
+        index = AppearanceIndex()
+        index.profiles.pop(name, None)
+        index.save()
+
+    arguably.run()
+
+
+def signature_of(
+    frame: MatLike,
+    box: tuple[int, int, int, int],
+    mask: MatLike | None = None,
+) -> np.ndarray:
+    """
+    the appearance of what is inside `box` (x, y, w, h) of a BGR frame; `mask` (of the whole frame, e.g. the motion
+    mask) keeps the histograms on the moving pixels instead of the floor around them
+    - the crop is downscaled to `CROP_PIXELS` first: the cost does not depend on the resolution or the box size
+    - the size is relative to the frame, so signatures compare across resolutions
+    """
+    x, y, w, h = box
+    frame_height, frame_width = frame.shape[:2]
+    crop = frame[y : y + h, x : x + w]
+    factor = min(1.0, CROP_PIXELS / max(w, h))
+    size = (max(1, round(w * factor)), max(1, round(h * factor)))
+    crop = cv2.resize(crop, size, interpolation=cv2.INTER_NEAREST)
+    hsv = cv2.cvtColor(crop, cv2.COLOR_BGR2HSV)
+    crop_mask = None
+    if mask is not None:
+        crop_mask = cv2.resize(
+            mask[y : y + h, x : x + w], size, interpolation=cv2.INTER_NEAREST
+        )
+        if cv2.countNonZero(crop_mask) == 0:
+            crop_mask = None
+    saturation = cv2.calcHist([hsv], [1], crop_mask, [SATURATION_BINS], [0, 256])
+    value = cv2.calcHist([hsv], [2], crop_mask, [VALUE_BINS], [0, 256])
+    pixels = max(1.0, float(saturation.sum()))
+    # the hue of grey or dark pixels is noise: a black cat would land in random hue bins
+    colored = cv2.inRange(hsv, (0, HUE_MIN_SATURATION, 32), (180, 255, 255))
+    if crop_mask is not None:
+        colored = cv2.bitwise_and(colored, crop_mask)
+    hue = cv2.calcHist([hsv], [0], colored, [HUE_BINS], [0, 180])
+    histograms = [histogram.ravel() / pixels for histogram in (hue, saturation, value)]
+    shape = np.array(
+        [
+            SIZE_WEIGHT * np.sqrt(w * h / (frame_width * frame_height)),
+            ASPECT_WEIGHT * np.log(w / h),
+        ],
+        dtype=np.float32,
+    )
+    return np.concatenate(histograms + [shape]).astype(np.float32)
+
+
+def signature_of_motion(
+    frame: MatLike,
+    boxes: list[tuple[int, int, int, int]],
+    mask: MatLike | None = None,
+) -> np.ndarray | None:
+    """
+    the signature of the largest motion box; `frame` must not have the boxes drawn on it yet
+    """
+    if len(boxes) == 0:
+        return None
+    return signature_of(frame, max(boxes, key=lambda box: box[2] * box[3]), mask)
+
+
+def without_drawn_boxes(
+    frame: MatLike, mask: MatLike, color: tuple[int, int, int]
+) -> MatLike:
+    """
+    `mask` without the pixels of the boxes of `color` that the live detector drew on the frames of a recording
+    (a box of another motion may cross the largest one, so trimming its border is not enough)
+    """
+    low = tuple(max(0, c - DRAWN_BOX_TOLERANCE) for c in color)
+    high = tuple(min(255, c + DRAWN_BOX_TOLERANCE) for c in color)
+    drawn = cv2.dilate(cv2.inRange(frame, low, high), np.ones((3, 3), np.uint8))
+    return cv2.bitwise_and(mask, cv2.bitwise_not(drawn))
+
+
+def frames_of(capture: cv2.VideoCapture, scale: float):
+    while True:
+        ret, frame = capture.read()
+        if not ret:
+            return
+        if scale != 1:
+            frame = cv2.resize(
+                frame, None, fx=scale, fy=scale, interpolation=cv2.INTER_AREA
+            )
+        yield frame
+
+
+def signatures_of_recording(path: pathlib.Path, scale: float, end_second: int = 3600):
+    """
+    (second, signature) of the moving object at each second of an hourly recording, which has one frame per second
+    as the live detector saw them; the same `MotionKernel` finds the motion
+    """
+    from motion_detector import MotionKernel, BOX_COLOR  # it imports this module
+
+    capture = cv2.VideoCapture(str(path))
+    kernel = MotionKernel(blur_size=max(3, int(21 * scale) | 1))
+    for second, frame in enumerate(frames_of(capture, scale)):
+        if second >= end_second:
+            break
+        if not kernel.update(frame, datetime.fromtimestamp(second)):
+            continue
+        mask = without_drawn_boxes(frame, kernel.mask, BOX_COLOR)
+        signature = signature_of_motion(frame, kernel.boxes, mask)
+        if signature is not None:
+            yield second, signature
+    capture.release()
+
+
+class AppearanceIndex:
+    """
+    the enrolled profiles (a few dozen signatures per identity) and a brute-force nearest neighbour over all of them:
+    with a few hundred signatures of `SIZE` floats, one vectorized L1 distance is a few microseconds, far below
+    the cost of any index structure
+    - a signature further than `max_distance` from every profile is `UNKNOWN`
+    - the profiles are a JSON file written by `python3 appearance.py enroll`; `reload` picks up a new version
+        without restarting the detector
+    """
+
+    def __init__(
+        self,
+        path: pathlib.Path = this_dir / "appearance.json",
+        max_distance: float = 0.8,
+    ):
+        self.path = path
+        self.max_distance = max_distance
+        self.profiles: dict[str, list[np.ndarray]] = {}
+        self.names: list[str] = []
+        self.matrix = np.zeros((0, SIZE), dtype=np.float32)
+        self.mtime: float | None = None
+        self.reload()
+
+    def reload(self) -> None:
+        try:
+            mtime = self.path.stat().st_mtime
+        except FileNotFoundError:
+            mtime = None
+        if mtime == self.mtime:
+            return
+        self.mtime = mtime
+        profiles: dict[str, list[np.ndarray]] = {}
+        if mtime is not None:
+            with open(self.path, "r") as f:
+                for name, signatures in json.load(f).items():
+                    profiles[name] = [
+                        np.array(signature, dtype=np.float32)
+                        for signature in signatures
+                        if len(signature) == SIZE  # enrolled with another layout
+                    ]
+            _LOGGER.info(
+                f"Loaded {len(profiles)} appearance profiles at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+        self.profiles = profiles
+        self.build()
+
+    def build(self) -> None:
+        self.names = []
+        rows: list[np.ndarray] = []
+        for name, signatures in self.profiles.items():
+            self.names += [name] * len(signatures)
+            rows += signatures
+        self.matrix = np.stack(rows) if rows else np.zeros((0, SIZE), dtype=np.float32)
+
+    def save(self) -> None:
+        with open(self.path, "w") as f:
+            json.dump(
+                {
+                    name: [signature.round(4).tolist() for signature in signatures]
+                    for name, signatures in self.profiles.items()
+                },
+                f,
+            )
+
+    def enroll(
+        self, name: str, signatures: list[np.ndarray], max_signatures: int = 64
+    ) -> None:
+        signatures = self.profiles.get(name, []) + signatures
+        if len(signatures) > max_signatures:
+            # evenly spread over everything that was enrolled
+            step = len(signatures) / max_signatures
+            signatures = [signatures[int(i * step)] for i in range(max_signatures)]
+        self.profiles[name] = signatures
+        self.build()
+
+    def nearest(self, signature: np.ndarray) -> tuple[str, float] | None:
+        if len(self.names) == 0:
+            return None
+        distances = np.abs(self.matrix - signature).sum(axis=1)
+        index = int(distances.argmin())
+        return self.names[index], float(distances[index])
+
+    def identify(self, signature: np.ndarray) -> str:
+        """
+        the name of the nearest profile, `UNKNOWN` if it is too far or nothing is enrolled
+        """
+        nearest = self.nearest(signature)
+        if nearest is None or nearest[1] > self.max_distance:
+            return UNKNOWN
+        return nearest[0]
+
+
+if __name__ == "__main__":
+    main()
@@ -1,9 +1,23 @@
-from motion_detector import MotionDetector, this_dir
-from wet_feeder import WetFoodFeeder
-from auto_deleter import AutoDeleter
+from motion_detector import this_dir
+from detector_process import DetectorProcess
+from wet_feeder import WetFoodFeeder, SimulatedFeeder
+from auto_deleter import recordings_retention
 from auto_torch import AutoTorch
+from metrics_store import MetricsStore
+from detector_api import DetectorAPI
+from audio_trigger import AudioTrigger
+from arrival_model import ArrivalModel
+from status_gateway import StatusGateway, Source, fetch_dry_feeder
+from plate_state import PlateMonitor, OPEN, CLOSED
+from feeder_scheduler import FeederScheduler
+from control_socket import ControlServer
+from recordings_server import RecordingsServer
+from timeline_api import TimelineAPI
+from fleet import Fleet, HEARTBEAT_INTERVAL
 import asyncio
 import aiohttp
+import shutil
+from aiohttp import web
 import arguably
 from datetime import datetime, timedelta
 from logging import getLogger
@@ -29,16 +43,40 @@ def run_main(
     wet_max_duration_per_hour: int = 5 * 60,  # 5 minutes is usually sufficient
     hourly_max_GB: float = 20,
     original_max_GB: float = 20,
+    recordings_max_GB: float = 40,
+    min_free_GB: float = 5,
     ip_port: str = "192.168.0.91:8080",
+    resolution: str = "1920x1080",  # of the camera, e.g. "3840x2160"
+    capture_url: str = "",  # the RTSP stream of the camera by default
+    http_port: int = 8081,
+    dry_feeder_url: str = "http://192.168.0.166",
+    audio_trigger: bool = True,
+    prewarm_probability: float = 0.3,
+    preopen_probability: float = 0,  # 0 disables pre-opening
+    preopen_seconds: float = 120,
+    feed_identities: str = "",  # e.g. "momo,unknown"; empty opens for any motion
+    simulated_feeder: bool = False,  # no cloud, for `synthetic_camera.py`
 ):
     asyncio.run(
         main(
             plate=plate,
             hourly_max_GB=hourly_max_GB,
             original_max_GB=original_max_GB,
+            recordings_max_GB=recordings_max_GB,
+            min_free_GB=min_free_GB,
             ip_port=ip_port,
+            resolution=resolution,
+            capture_url=capture_url,
+            http_port=http_port,
+            dry_feeder_url=dry_feeder_url,
+            audio_trigger=audio_trigger,
+            prewarm_probability=prewarm_probability,
+            preopen_probability=preopen_probability,
+            preopen_seconds=preopen_seconds,
+            feed_identities=feed_identities,
             wet_max_times_per_hour=wet_max_times_per_hour,
             wet_max_duration_per_hour=wet_max_duration_per_hour,
+            simulated_feeder=simulated_feeder,
         )
     )
 
@@ -47,9 +85,21 @@ async def main(
     plate: int,
     hourly_max_GB: float,
     original_max_GB: float,
+    recordings_max_GB: float,
+    min_free_GB: float,
     ip_port: str,
+    resolution: str,
+    capture_url: str,
+    http_port: int,
+    dry_feeder_url: str,
+    audio_trigger: bool,
+    prewarm_probability: float,
+    preopen_probability: float,
+    preopen_seconds: float,
+    feed_identities: str,
     wet_max_times_per_hour: int,
     wet_max_duration_per_hour: int,
+    simulated_feeder: bool,
 ):
     """
     when motion is detected, feed until the motion is gone
@@ -57,9 +107,17 @@ async def main(
     Feed at most 10 times in the past hour: if more than that, it's probably unnecessarily
     """
     auto_torch = AutoTorch(ip_port=ip_port)
+    metrics = MetricsStore()
+
+    # local HTTP API for dashboards: /metrics/<name> and the detector routes (`DetectorAPI`)
+    app = web.Application()
+    metrics.add_routes(app)
+    RecordingsServer(folder=this_dir / "recordings").add_routes(app)
 
     async with aiohttp.ClientSession() as session:
-        feeder = WetFoodFeeder(session)
+        feeder = (
+            SimulatedFeeder(session) if simulated_feeder else WetFoodFeeder(session)
+        )
         await feeder.login()
 
         # stop feeding first to ensure that the reference image plate is closed
@@ -73,32 +131,241 @@ async def main(
             _LOGGER.error(e)
         await asyncio.sleep(3)
 
-        with MotionDetector(ip_port=ip_port) as detector:
+        # the detector runs in its own supervised process, see `DetectorProcess`
+        width, height = (int(size) for size in resolution.split("x"))
+        with DetectorProcess(
+            ip_port=ip_port,
+            width=width,
+            height=height,
+            capture_url=capture_url or None,
+        ) as detector:
+            detector_api = DetectorAPI(detector)
+            detector_api.add_routes(app)
+            TimelineAPI(detector.events).add_routes(app)
+
+            # one status document for home.html: every device is polled here only, at its own rate
+            async def controller_status() -> dict:
+                noisy = ("brightness", "detector_ipc_us")  # change every second
+                state = {k: v for k, v in detector_api.state.items() if k not in noisy}
+                return {
+                    "is_motion_detected": detector.is_motion_detected,
+                    "capture_ok": detector.capture_ok,
+                    **state,
+                }
+
+            async def storage_status() -> dict:
+                disk = shutil.disk_usage(this_dir / "recordings")
+                return {
+                    "recordings_bytes": retention.usage,
+                    "free_bytes": disk.free,
+                    "total_bytes": disk.total,
+                }
+
+            # the dry feeder announces itself with multicast heartbeats; its page is only polled when they do not
+            # arrive (an older firmware, or multicast filtered on the way)
+            fleet = Fleet()
+            try:
+                await fleet.start()
+            except OSError as e:
+                _LOGGER.error(
+                    f"Cannot listen to the heartbeats ({e}) at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+            dry_feeder_polled_at: datetime | None = None
+            dry_feeder_page: dict = {}
+
+            async def dry_feeder_status() -> dict:
+                nonlocal dry_feeder_polled_at, dry_feeder_page
+                try:
+                    return fleet.status_of("dry_feeder")
+                except LookupError:
+                    pass
+                if (
+                    dry_feeder_polled_at is None
+                    or datetime.now() > dry_feeder_polled_at + timedelta(seconds=30)
+                ):
+                    dry_feeder_page = await fetch_dry_feeder(session, dry_feeder_url)
+                    dry_feeder_polled_at = datetime.now()
+                return dry_feeder_page
+
+            sources = [
+                Source("controller", controller_status, interval=2),
+                Source("storage", storage_status, interval=60),
+                Source("dry_feeder", dry_feeder_status, interval=HEARTBEAT_INTERVAL),
+            ]
+            if not simulated_feeder:
+                # every device of the account at once: as long as the slowest query, not their sum
+                sources.append(
+                    Source(
+                        "petlibro",
+                        lambda: feeder.api.snapshot(concurrency=4, deadline=12),
+                        interval=60,
+                        timeout=15,
+                    )
+                )
+            gateway = StatusGateway(sources)
+            gateway.add_routes(app)
+            runner = web.AppRunner(app)
+            await runner.setup()
+            await web.TCPSite(runner, port=http_port).start()
 
             is_feeding = False
             past_hour_feeds: list[bool] = [False] * 3600
             past_hour_starts: list[bool] = [False] * 3600
             first_no_motion: datetime | None = None
 
-            hourly_deleter = AutoDeleter(
-                folder=this_dir / "recordings",
-                file_prefix="hourly_",
-                file_suffix=".mp4",
-                size_limit=hourly_max_GB * 1024 * 1024 * 1024,
+            retention = recordings_retention(
+                this_dir / "recordings",
+                hourly_max_GB=hourly_max_GB,
+                original_max_GB=original_max_GB,
+                recordings_max_GB=recordings_max_GB,
+                min_free_GB=min_free_GB,
+                events=detector.events,
             )
-            original_deleter = AutoDeleter(
-                folder=this_dir / "recordings",
-                file_prefix="original_",
-                file_suffix=".mp4",
-                size_limit=original_max_GB * 1024 * 1024 * 1024,
+            retention.start()
+            gateway.start()
+
+            # a meow or footsteps usually come before the cat reaches the plate, especially at night
+            audio: AudioTrigger | None = None
+            if audio_trigger:
+                audio = AudioTrigger(ip_port=ip_port, events=detector.events)
+                audio.start()
+
+            # Momo's routine: pre-warm the cloud session (and optionally pre-open the plate) when he usually comes
+            arrivals = ArrivalModel.from_events(detector.events)
+            feed_event: int | None = None
+            last_prewarm: datetime | None = None
+            preopen_until: datetime | None = None
+            preopened_window: tuple | None = None
+
+            # per-identity gating: only the motion of these profiles opens the plate (see `appearance.py`)
+            allowed_identities = {
+                name.strip() for name in feed_identities.split(",") if name.strip()
+            }
+            ignored_identity: str | None = None
+
+            # the camera confirms every open and close command, see `PlateMonitor`
+            plate_monitor = PlateMonitor()
+            if not plate_monitor.enabled:
+                _LOGGER.info(
+                    "No plate templates, the commands are not confirmed at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+            # every open and close goes through it: latest wins, one in flight, never flapping faster than the dwell
+            scheduler = FeederScheduler(feeder, plate=plate, on_sent=plate_monitor.sent)
+            scheduler.start()
+
+            # manual operations (`python3 control_socket.py ...`), applied to the state of this loop right away
+            control = ControlServer()
+            paused_until: datetime | None = None  # no automatic opening before
+
+            def manual_feed(plate: int | None = None, seconds: float = 120) -> dict:
+                nonlocal is_feeding, feed_event, preopen_until, first_no_motion
+                if plate is not None and plate != scheduler.plate:
+                    raise ValueError(f"the daemon feeds plate {scheduler.plate}")
+                if not is_feeding:
+                    feed_event = detector.events.start("manual")
+                is_feeding = True
+                first_no_motion = None
+                # held open like a pre-open, then closed like any feed
+                preopen_until = datetime.now() + timedelta(seconds=seconds)
+                scheduler.request(OPEN)
+                return {"plate": scheduler.intent, "until": preopen_until.isoformat()}
+
+            def manual_close(seconds: float = 60) -> dict:
+                nonlocal is_feeding, feed_event, preopen_until, first_no_motion
+                nonlocal paused_until
+                is_feeding = False
+                first_no_motion = None
+                preopen_until = None
+                if feed_event is not None:
+                    detector.events.end(feed_event)
+                    feed_event = None
+                # otherwise the motion of whoever closed it opens it again
+                paused_until = datetime.now() + timedelta(seconds=seconds)
+                scheduler.request(CLOSED)
+                return {
+                    "plate": scheduler.intent,
+                    "paused_until": paused_until.isoformat(),
+                }
+
+            async def manual_torch(on: bool) -> dict:
+                await asyncio.get_running_loop().run_in_executor(
+                    None, auto_torch.set, on
+                )
+                return {"torch": on}
+
+            control.add("feed", manual_feed)
+            control.add("close", manual_close)
+            control.add("torch", manual_torch)
+            control.add(
+                "state",
+                lambda: {
+                    **detector_api.state,
+                    "is_motion_detected": detector.is_motion_detected,
+                    "plate_applied": scheduler.applied,
+                },
             )
+            await control.start()
+
+            last_frames_read = detector.frames_read
 
             while True:
                 if detector.frame is not None:
                     auto_torch.run(detector.frame)
-                hourly_deleter.run()
-                original_deleter.run()
+
+                # health metrics of the past second
+                # a restarted detector counts from 0 again
+                metrics.append(
+                    "detector_fps", max(0, detector.frames_read - last_frames_read)
+                )
+                last_frames_read = detector.frames_read
+                metrics.append("capture_ok", detector.capture_ok)
+                metrics.append("detector_ipc_us", detector.ipc_us)
+                metrics.append("detector_restarts", detector.restarts)
+                metrics.append("appearance_us", detector.appearance_us)
+                metrics.append("detector_peak_rss_mb", detector.peak_rss_mb)
+                metrics.append("motion", detector.is_motion_detected)
+                metrics.append("feeding", is_feeding)
+                metrics.append("feed_starts", past_hour_starts[-1])
+                if auto_torch.brightness is not None:
+                    metrics.append("brightness", auto_torch.brightness)
+                metrics.append("torch", bool(auto_torch.current_on))
+                if plate_monitor.state is not None:
+                    metrics.append("plate_open", plate_monitor.state == OPEN)
+                detector_api.state.update(
+                    is_feeding=is_feeding,
+                    feeds_past_hour=sum(past_hour_starts),
+                    feeding_seconds_past_hour=sum(past_hour_feeds),
+                    torch=auto_torch.current_on,
+                    brightness=auto_torch.brightness,
+                    detector_restarts=detector.restarts,
+                    detector_restart_seconds=detector.last_restart_seconds,
+                    detector_ipc_us=detector.ipc_us,
+                    detector_peak_rss_mb=round(detector.peak_rss_mb),
+                    identity=detector.identity,
+                    plate=plate_monitor.state,
+                    plate_intent=scheduler.intent,
+                    plate_failures=plate_monitor.failures,
+                    commands_coalesced=scheduler.coalesced,
+                    command_failures=scheduler.failures,
+                )
+
                 await asyncio.sleep(1)
+                detector.poll()
+
+                # a command the camera did not confirm is sent again, only if it is still what we want
+                retry = plate_monitor.update(detector.snapshot)
+                if retry is not None and retry == scheduler.intent:
+                    scheduler.resend()
+                if plate_monitor.failed == OPEN and is_feeding:
+                    # it never opened: the next motion starts over
+                    is_feeding = False
+                    scheduler.request(CLOSED)
+                    if feed_event is not None:
+                        detector.events.end(feed_event)
+                        feed_event = None
+                plate_monitor.failed = None
 
                 past_hour_feeds.append(is_feeding)
                 past_hour_starts.append(False)
@@ -107,27 +374,74 @@ async def main(
                 while len(past_hour_starts) > 3600:
                     past_hour_starts.pop(0)
 
-                if detector.is_motion_detected:
+                audio_triggered = audio is not None and audio.triggered_within(5)
+                metrics.append("audio_trigger", audio_triggered)
+
+                now = datetime.now()
+                arrival_probability = arrivals.probability(now)
+                metrics.append("arrival_probability", arrival_probability)
+                if arrival_probability >= prewarm_probability and (
+                    last_prewarm is None or now - last_prewarm > timedelta(minutes=5)
+                ):
+                    last_prewarm = now
+                    asyncio.create_task(feeder.prewarm())
+                window = (now.date(), arrivals.bin_of(now))
+                if (
+                    preopen_probability > 0
+                    and arrival_probability >= preopen_probability
+                    and window != preopened_window
+                    and not is_feeding
+                ):
+                    # once per window; closes like any feed when nothing shows up
+                    preopened_window = window
+                    preopen_until = now + timedelta(seconds=preopen_seconds)
+                predicted = preopen_until is not None and now < preopen_until
+                motion = detector.is_motion_detected
+                if allowed_identities and motion:
+                    if detector.identity not in allowed_identities:
+                        motion = False
+                        if detector.identity != ignored_identity:
+                            _LOGGER.info(
+                                f"Ignoring the motion of {detector.identity} at "
+                                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                            )
+                    ignored_identity = None if motion else detector.identity
+                triggered = motion or audio_triggered
+                if motion:
+                    # only seen arrivals teach the model: pre-opens would reinforce themselves, and a sound
+                    # is often Momo somewhere else in the flat
+                    arrivals.add(now)
+
+                if triggered or predicted:
                     first_no_motion = None
                     # feed at most 10 times in the past hour: if more than that, it's probably unnecessarily
                     if (
                         not is_feeding
+                        and (paused_until is None or now >= paused_until)
                         and sum(past_hour_starts) < wet_max_times_per_hour
                         and sum(past_hour_feeds) < wet_max_duration_per_hour
                     ):
+                        reason = (
+                            f"for {detector.identity} "
+                            if motion and detector.identity is not None
+                            else (
+                                ""
+                                if motion
+                                else "on sound " if audio_triggered else "in advance "
+                            )
+                        )
                         _LOGGER.info(
-                            "Start feeding at "
+                            "Start feeding "
+                            + reason
+                            + "at "
                             + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
                         )
                         past_hour_starts[-1] = True  # mark the last one as True
-                        try:
-                            await feeder.manual_feed_now(plate)
-                        except Exception as e:
-                            _LOGGER.error(
-                                "Failed to start feeding at "
-                                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                            )
-                            _LOGGER.error(e)
+                        feed_event = detector.events.start(
+                            "feed" if triggered else "preopen"
+                        )
+                        # the scheduler keeps sending it until the cloud takes it
+                        scheduler.request(OPEN)
                         is_feeding = True
                     # feeding too long: preserve freshness instead of feeding for too long (>10min)
                     elif (
@@ -135,18 +449,15 @@ async def main(
                         and sum(past_hour_feeds) > wet_max_duration_per_hour + 120
                     ):
                         is_feeding = False
+                        preopen_until = None
+                        if feed_event is not None:
+                            detector.events.end(feed_event)
+                            feed_event = None
                         _LOGGER.info(
                             "Stop feeding because it has been feeding for too long at "
                             + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
                         )
-                        try:
-                            await feeder.stop_feed_now()
-                        except Exception as e:
-                            _LOGGER.error(
-                                "Failed to stop feeding at "
-                                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                            )
-                            _LOGGER.error(e)
+                        scheduler.request(CLOSED)
                 else:
                     if is_feeding:
                         if first_no_motion is None:
@@ -160,14 +471,14 @@ async def main(
                         if datetime.now() - first_no_motion > timedelta(seconds=30):
                             is_feeding = False
                             first_no_motion = None
+                            if feed_event is not None:
+                                detector.events.end(feed_event)
+                                feed_event = None
                             _LOGGER.info(
                                 "Stop feeding at "
                                 + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
                             )
-                            try:
-                                await feeder.stop_feed_now()
-                            except Exception as e:
-                                _LOGGER.error(e)
+                            scheduler.request(CLOSED)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,115 @@
+import os
+import sys
+from dataclasses import dataclass, field
+import logging
+from logging import getLogger
+from datetime import date, datetime, timedelta
+import arguably
+from event_index import EventIndex
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+def main():
+
+    @arguably.command
+    def show(*, days: int = 60):
+        """
+        print the learned arrival probability of each time-of-day window
+        """
+        model = ArrivalModel.from_events(EventIndex(), days=days)
+        for index, probability in enumerate(model.probabilities()):
+            minutes = index * model.bin_minutes
+            bar = "#" * round(probability * 40)
+            print(f"{minutes // 60:02d}:{minutes % 60:02d} {probability:.2f} {bar}")
+
+    arguably.run()
+
+
+@dataclass
+class ArrivalModel:
+    """
+    how likely Momo arrives in each time-of-day window (15 minutes by default), learned from the feed history
+    at startup and then from every motion trigger
+    - a streaming histogram: each arrival marks its window at most once per day, and when the day is over the marks
+        are added to the counts after decaying them by `decay`, so that the model follows changes of routine within
+        a couple of weeks
+    - the probability of a window is its decayed count over the decayed number of completed days; the current day
+        is left out, as are the first `min_days`, so a single arrival does not make a window certain
+    """
+
+    bin_minutes: int = 15
+    decay: float = 0.95  # per day
+    min_days: int = 3
+
+    counts: list[float] = field(default_factory=list, init=False)
+    days: float = field(default=0, init=False)
+    completed_days: int = field(default=0, init=False)
+    today: date | None = field(default=None, init=False)
+    seen_today: set[int] = field(default_factory=set, init=False)
+
+    def __post_init__(self):
+        assert 24 * 60 % self.bin_minutes == 0, "bins must tile the day"
+        self.counts = [0.0] * (24 * 60 // self.bin_minutes)
+
+    @classmethod
+    def from_events(
+        cls, events: EventIndex, days: int = 60, kinds: tuple[str, ...] = ("feed",)
+    ) -> "ArrivalModel":
+        model = cls()
+        now = datetime.now()
+        for event in events.query(now - timedelta(days=days), now):
+            if event.kind in kinds:
+                model.add(event.start)
+        model.advance(now.date())
+        return model
+
+    def bin_of(self, t: datetime) -> int:
+        return (t.hour * 60 + t.minute) // self.bin_minutes
+
+    def advance(self, day: date) -> None:
+        if self.today is None:
+            self.today = day
+            return
+        elapsed = (day - self.today).days
+        if elapsed <= 0:
+            return
+        factor = self.decay**elapsed
+        self.counts = [count * factor for count in self.counts]
+        # the day that just ended, then the days without any arrival, if any
+        for index in self.seen_today:
+            self.counts[index] += self.decay ** (elapsed - 1)
+        # the decayed sum of one per day over the elapsed days
+        self.days = self.days * factor + sum(self.decay**i for i in range(elapsed))
+        self.completed_days += elapsed
+        self.today = day
+        self.seen_today.clear()
+
+    def add(self, t: datetime) -> None:
+        self.advance(t.date())
+        index = self.bin_of(t)
+        if t.date() != self.today or index in self.seen_today:
+            return  # older than the current day, or already counted today
+        self.seen_today.add(index)
+        self.counts[index] += 1
+
+    def probability(self, t: datetime) -> float:
+        self.advance(t.date())
+        if self.completed_days < self.min_days:
+            return 0
+        return min(1.0, self.counts[self.bin_of(t)] / self.days)
+
+    def probabilities(self) -> list[float]:
+        if self.completed_days < self.min_days:
+            return [0.0] * len(self.counts)
+        return [min(1.0, count / self.days) for count in self.counts]
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,230 @@
+import pathlib
+import os
+import sys
+import json
+import time
+import subprocess
+from dataclasses import dataclass, field
+from threading import Thread
+import logging
+from logging import getLogger
+from datetime import datetime, timedelta
+import numpy as np
+from event_index import EventIndex
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+SAMPLE_RATE = 8000  # G.711 u-law, as in `h264_ulaw.sdp`
+FRAME = 256  # 32ms per analysis frame
+
+
+def main():
+    # print the features of the live stream, to tune the thresholds
+    with AudioTrigger(verbose=True):
+        while True:
+            time.sleep(1)
+
+
+def ulaw_table() -> np.ndarray:
+    """
+    G.711 u-law to linear 16-bit PCM for all 256 codes, so decoding a packet is a single table lookup
+    """
+    codes = ~np.arange(256, dtype=np.int32) & 0xFF
+    sign = codes & 0x80
+    exponent = (codes >> 4) & 0x07
+    mantissa = codes & 0x0F
+    magnitude = (((mantissa << 3) + 0x84) << exponent) - 0x84
+    return np.where(sign != 0, -magnitude, magnitude).astype(np.int16)
+
+
+ULAW = ulaw_table()
+
+
+@dataclass
+class AudioFeatures:
+    """
+    streaming features over fixed 32ms frames: energy (dBFS), spectral flux (onsets such as footsteps) and the
+    share of the energy in the band of a meow (its fundamental and first harmonics, ~400-1600Hz)
+    - the noise floor tracks the minimum of all frames: it starts at the first frame, follows a quieter frame
+        quickly and a louder one slowly (~30s), so the thresholds are relative to the room at that time, a loud room
+        included, while a meow of 2s barely moves it
+    - a meow is a run of loud, band-limited frames between 150ms and 2s
+    - footsteps are a few sharp onsets in a short window
+    """
+
+    meow_band: tuple[float, float] = (400, 1600)
+    meow_ratio: float = 0.6
+    loud_db: float = 12  # above the noise floor
+    meow_min: float = 0.15
+    meow_max: float = 2.0
+    onset_flux: float = 4.0  # relative to the running mean of the flux
+    steps_count: int = 3
+    steps_window: float = 2.0
+
+    floor_rise: float = 0.001  # per frame, towards a louder frame
+    floor_fall: float = 0.1  # per frame, towards a quieter frame
+
+    noise_floor: float | None = None  # dBFS
+    mean_flux: float = 1e-3
+    window: np.ndarray = field(default_factory=lambda: np.hanning(FRAME))
+    last_spectrum: np.ndarray | None = None
+    meow_frames: int = 0
+    onsets: list[float] = field(default_factory=list)
+    length: float = 0  # of the last detected sound, in seconds
+
+    def __post_init__(self):
+        frequencies = np.fft.rfftfreq(FRAME, 1 / SAMPLE_RATE)
+        self.band = (frequencies >= self.meow_band[0]) & (
+            frequencies <= self.meow_band[1]
+        )
+
+    def update(self, samples: np.ndarray, now: float) -> tuple[dict, str | None]:
+        """
+        `samples` is one frame of linear PCM; returns the features and the detected sound ("meow", "footsteps")
+        """
+        x = samples.astype(np.float32) / 32768
+        energy = float(np.mean(x * x))
+        db = 10 * np.log10(energy + 1e-10)
+        spectrum = np.abs(np.fft.rfft(x * self.window))
+        power = spectrum * spectrum
+        ratio = float(power[self.band].sum() / (power.sum() + 1e-12))
+        flux = 0.0
+        if self.last_spectrum is not None:
+            flux = float(np.maximum(spectrum - self.last_spectrum, 0).sum())
+        self.last_spectrum = spectrum
+        if self.noise_floor is None:
+            self.noise_floor = db
+        loud = db > self.noise_floor + self.loud_db
+        rate = self.floor_rise if db > self.noise_floor else self.floor_fall
+        self.noise_floor += rate * (db - self.noise_floor)
+
+        detected: str | None = None
+        frame_seconds = FRAME / SAMPLE_RATE
+        if loud and ratio > self.meow_ratio:
+            self.meow_frames += 1
+        else:
+            length = self.meow_frames * frame_seconds
+            if self.meow_min <= length <= self.meow_max:
+                detected = "meow"
+                self.length = length
+            self.meow_frames = 0
+
+        if loud and flux > self.onset_flux * self.mean_flux:
+            self.onsets = [t for t in self.onsets if now - t < self.steps_window]
+            self.onsets.append(now)
+            if len(self.onsets) >= self.steps_count and detected is None:
+                detected = "footsteps"
+                self.length = now - self.onsets[0]
+                self.onsets.clear()
+        self.mean_flux += 0.02 * (flux - self.mean_flux)
+
+        features = {
+            "db": db,
+            "noise_floor": self.noise_floor,
+            "flux": flux,
+            "meow_ratio": ratio,
+        }
+        return features, detected
+
+
+class AudioTrigger:
+    """
+    the camera stream has a u-law audio track that OpenCV discards; this reads it with a separate ffmpeg process
+    (`-c:a copy`, so ffmpeg only demuxes the RTP packets) and runs `AudioFeatures` on it in a background thread.
+    At night a meow or footsteps come before the cat reaches the plate, so the controller uses `triggered_within`
+    as an extra trigger to open the plate earlier.
+    """
+
+    def __init__(
+        self,
+        ip_port: str = "192.168.0.91:8080",
+        events: EventIndex | None = None,
+        verbose: bool = False,
+    ):
+        with open(this_dir / "credentials.json", "r") as f:
+            credentials = json.load(f)
+            username = credentials["webcam"]["username"]
+            password = credentials["webcam"]["password"]
+
+        self.capture_url = f"rtsp://{username}:{password}@{ip_port}/h264_ulaw.sdp"
+        self.events = events
+        self.verbose = verbose
+        self.features = AudioFeatures()
+        self.last_trigger: float | None = None
+        self.last_sound: str | None = None
+        self.stopped = False
+        self.process: subprocess.Popen | None = None
+
+    def __enter__(self) -> "AudioTrigger":
+        self.start()
+        return self
+
+    def start(self) -> None:
+        self.thread = Thread(target=self._thread_function, daemon=True)
+        self.thread.start()
+
+    def __exit__(self, exc_type, exc_value, traceback) -> None:
+        self.stopped = True
+        if self.process is not None:
+            self.process.kill()
+
+    def triggered_within(self, seconds: float) -> bool:
+        last_trigger = self.last_trigger
+        return last_trigger is not None and time.time() - last_trigger < seconds
+
+    def _thread_function(self) -> None:
+        while not self.stopped:
+            self.process = subprocess.Popen(
+                ["ffmpeg", "-v", "error", "-rtsp_transport", "tcp"]
+                + ["-i", self.capture_url, "-vn", "-map", "0:a:0"]
+                + ["-c:a", "copy", "-f", "mulaw", "-"],
+                stdout=subprocess.PIPE,
+            )
+            assert self.process.stdout is not None
+            while not self.stopped:
+                packet = self.process.stdout.read(FRAME)
+                if len(packet) < FRAME:
+                    break
+                self.process_frame(packet)
+            self.process.kill()
+            self.process.wait()
+            if not self.stopped:
+                _LOGGER.error(
+                    "Audio stream ended, reconnecting at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+                time.sleep(5)
+
+    def process_frame(self, packet: bytes) -> None:
+        samples = ULAW[np.frombuffer(packet, dtype=np.uint8)]
+        now = time.time()
+        features, detected = self.features.update(samples, now)
+        if self.verbose:
+            print(features, detected or "")
+        if detected is None:
+            return
+        _LOGGER.info(
+            f"Audio trigger ({detected}) at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+        self.last_trigger = now
+        self.last_sound = detected
+        if self.events is not None:
+            # the sound is reported when it ends
+            end = datetime.fromtimestamp(now)
+            start = end - timedelta(seconds=self.features.length)
+            event_id = self.events.start(detected, start)
+            self.events.end(event_id, end)
+
+
+if __name__ == "__main__":
+    main()
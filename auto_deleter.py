@@ -1,10 +1,15 @@
 import pathlib
 import os
 import sys
-from dataclasses import dataclass
+import shutil
+import time
+from dataclasses import dataclass, field
+from threading import Event, Thread
 import logging
 from logging import getLogger
-from datetime import datetime
+from datetime import datetime, timedelta
+import arguably
+from event_index import EventIndex, recording_start
 
 
 if "DEBUG" in os.environ:
@@ -17,68 +22,245 @@ _LOGGER = getLogger(__name__)
 
 this_dir = pathlib.Path(__file__).parent
 
+GB = 1024 * 1024 * 1024
+
 
 def main():
-    deleter = AutoDeleter(folder=this_dir / "recordings", size_limit=500 * 1024 * 1024)
-    print("folder size: ", deleter.get_folder_size())
-    print("to be deleted: ", deleter.to_be_deleted(deleter.get_filepaths()))
-    input("Press Enter to continue...")
-    deleter.run()
+    @arguably.command
+    def preview(
+        *,
+        hourly_max_GB: float = 20,
+        original_max_GB: float = 20,
+        recordings_max_GB: float = 40,
+        min_free_GB: float = 5,
+        delete: bool = False,
+    ):
+        """
+        print what the retention of `approach_feeder.py` deletes with these limits (its defaults)
+        - `--delete` also deletes it now
+        """
+        events = EventIndex()
+        retention = recordings_retention(
+            this_dir / "recordings",
+            hourly_max_GB=hourly_max_GB,
+            original_max_GB=original_max_GB,
+            recordings_max_GB=recordings_max_GB,
+            min_free_GB=min_free_GB,
+            events=events,
+        )
+        files = retention.get_files()
+        usage = sum(file.size for file in files)
+        for file in retention.to_be_deleted(files):
+            print(file.filepath.name)
+        print(
+            f"usage: {usage / GB:.2f} GB, budget: {retention.budget(usage) / GB:.2f} GB"
+        )
+        if delete:
+            retention.enforce()
+        events.close()
+
+    arguably.run()
 
 
 @dataclass
-class AutoDeleter:
-    folder: pathlib.Path
-    file_prefix: str = "hourly_"
+class RecordingClass:
+    file_prefix: str
+    # files of a class with priority 2 are kept twice as long as those with priority 1 under disk pressure
+    priority: float = 1
     file_suffix: str = ".mp4"
-    size_limit: float = 20 * 1024 * 1024 * 1024  # 20GB, 0.5GB per hour
+    size_limit: float | None = None  # optional cap of this class alone
+    length: timedelta = timedelta(hours=1)  # the longest time span a single file covers
 
-    def run(self):
-        filepaths = self.get_filepaths()
-        self.delete_oldest_files(filepaths)
 
-    def get_filepaths(self) -> list[pathlib.Path]:
-        filenames: list[tuple[pathlib.Path, float]] = []
-        for filename in os.listdir(self.folder):
-            if not filename.startswith(self.file_prefix):
-                continue
-            if not filename.endswith(self.file_suffix):
+@dataclass
+class RecordingFile:
+    filepath: pathlib.Path
+    recording_class: RecordingClass
+    start: datetime
+    mtime: float
+    size: int
+
+    def weighted_age(self, now: float) -> float:
+        return (now - self.mtime) / self.recording_class.priority
+
+
+@dataclass
+class RetentionEngine:
+    """
+    one retention policy for all classes of recordings in the folder
+    - the global budget is the smaller of `size_limit` and what fits on the disk while keeping `min_free` bytes free
+    - nothing happens until the usage goes above `high_water` of the budget; then the files with the largest
+        age / priority are deleted until the usage is below `low_water` of the budget (hysteresis, so that we
+        delete a batch once in a while instead of one file every second)
+    - recordings that overlap with a pinned event in the event index are never deleted
+    - the scan and the deletion run in a background thread, so `run` is free to call from the control loop
+    """
+
+    folder: pathlib.Path
+    classes: list[RecordingClass]
+    size_limit: float = 40 * 1024 * 1024 * 1024
+    min_free: float = 5 * 1024 * 1024 * 1024
+    high_water: float = 0.95
+    low_water: float = 0.85
+    interval: float = 60  # rescan at most once a minute unless woken up
+    batch_size: int = 16  # files deleted before yielding the disk to the recorders
+    events: EventIndex | None = None
+
+    wakeup: Event = field(default_factory=Event, init=False)
+    stopped: Event = field(default_factory=Event, init=False)
+    thread: Thread | None = field(default=None, init=False)
+    usage: int | None = field(default=None, init=False)  # bytes, as of the last scan
+
+    def __enter__(self) -> "RetentionEngine":
+        self.start()
+        return self
+
+    def start(self) -> None:
+        self.thread = Thread(target=self._thread_function, daemon=True)
+        self.thread.start()
+
+    def __exit__(self, exc_type, exc_value, traceback) -> None:
+        self.stopped.set()
+        self.wakeup.set()
+
+    def run(self) -> None:
+        # only signals the background thread to scan now; nothing happens on the caller's thread
+        self.wakeup.set()
+
+    def _thread_function(self) -> None:
+        while not self.stopped.is_set():
+            try:
+                self.enforce()
+            except Exception as e:
+                _LOGGER.error(
+                    "Retention failed at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+                _LOGGER.error(e)
+            self.wakeup.wait(timeout=self.interval)
+            self.wakeup.clear()
+
+    def get_files(self) -> list[RecordingFile]:
+        files: list[RecordingFile] = []
+        for entry in os.scandir(self.folder):
+            for recording_class in self.classes:
+                if not entry.name.endswith(recording_class.file_suffix):
+                    continue
+                start = recording_start(
+                    pathlib.Path(entry.path), recording_class.file_prefix
+                )
+                if start is None:
+                    continue
+                stat = entry.stat()
+                files.append(
+                    RecordingFile(
+                        pathlib.Path(entry.path),
+                        recording_class,
+                        start,
+                        stat.st_mtime,
+                        stat.st_size,
+                    )
+                )
+                break
+        return files
+
+    def is_pinned(self, file: RecordingFile, pinned: list) -> bool:
+        end = file.start + file.recording_class.length
+        for event in pinned:
+            if event.file == file.filepath.name:
+                return True
+            event_end = event.end or datetime.now()
+            if event.start < end and event_end >= file.start:
+                return True
+        return False
+
+    def budget(self, usage: int) -> float:
+        disk = shutil.disk_usage(self.folder)
+        return min(self.size_limit, usage + disk.free - self.min_free)
+
+    def to_be_deleted(self, files: list[RecordingFile]) -> list[RecordingFile]:
+        pinned = self.events.pinned() if self.events is not None else []
+        candidates = [file for file in files if not self.is_pinned(file, pinned)]
+        now = time.time()
+        candidates.sort(key=lambda file: file.weighted_age(now), reverse=True)
+        deletable = set(file.filepath for file in candidates)
+        to_be_deleted: list[RecordingFile] = []
+
+        # per-class caps first, oldest first within the class
+        for recording_class in self.classes:
+            if recording_class.size_limit is None:
                 continue
-            filepath = self.folder / filename
-            mtime = os.path.getmtime(filepath)
-            filenames.append((filepath, mtime))
-        filenames.sort(key=lambda x: x[1])
-        return [filepath for filepath, _ in filenames]
-
-    def size_of(self, filepaths: list[pathlib.Path]) -> int:
-        total_size = 0
-        for filepath in filepaths:
-            total_size += os.path.getsize(filepath)
-        return total_size
-
-    def get_folder_size(self) -> int:
-        return self.size_of(self.get_filepaths())
-
-    def to_be_deleted(self, filepaths: list[pathlib.Path]) -> list[pathlib.Path]:
-        to_be_deleted = []
-        size = 0
-        for filepath in reversed(filepaths):
-            file_size = os.path.getsize(filepath)
-            if size + file_size > self.size_limit:
-                to_be_deleted.append(filepath)
-            else:
-                size += file_size
+            of_class = [f for f in files if f.recording_class is recording_class]
+            size = sum(f.size for f in of_class)
+            for file in sorted(of_class, key=lambda f: f.mtime):
+                if size <= recording_class.size_limit:
+                    break
+                if file.filepath in deletable:
+                    deletable.remove(file.filepath)
+                    to_be_deleted.append(file)
+                    size -= file.size
+
+        usage = sum(f.size for f in files) - sum(f.size for f in to_be_deleted)
+        budget = self.budget(usage)
+        if usage <= self.high_water * budget:
+            return to_be_deleted
+        for file in candidates:
+            if usage <= self.low_water * budget:
+                break
+            if file.filepath not in deletable:
+                continue  # already deleted by the per-class cap
+            # the file being written by the recorder is the youngest and is never reached in practice
+            to_be_deleted.append(file)
+            usage -= file.size
         return to_be_deleted
 
-    def delete_oldest_files(self, filepaths: list[pathlib.Path]) -> None:
-        to_be_deleted = self.to_be_deleted(filepaths)
-        if to_be_deleted:
-            _LOGGER.info(
-                f"Deleting oldest files {to_be_deleted} at "
-                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-            )
-        for filepath in to_be_deleted:
-            os.remove(filepath)
+    def enforce(self) -> None:
+        files = self.get_files()
+        self.usage = sum(f.size for f in files)
+        to_be_deleted = self.to_be_deleted(files)
+        if not to_be_deleted:
+            return
+        _LOGGER.info(
+            f"Deleting {len(to_be_deleted)} files "
+            + f"({sum(f.size for f in to_be_deleted) / 1024 / 1024 / 1024:.2f} GB) at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+        for i in range(0, len(to_be_deleted), self.batch_size):
+            if self.stopped.is_set():
+                return
+            for file in to_be_deleted[i : i + self.batch_size]:
+                _LOGGER.debug(f"Deleting {file.filepath}")
+                try:
+                    os.remove(file.filepath)
+                except FileNotFoundError:
+                    pass
+            time.sleep(0.1)
+
+
+def recordings_retention(
+    folder: pathlib.Path,
+    *,
+    hourly_max_GB: float,
+    original_max_GB: float,
+    recordings_max_GB: float,
+    min_free_GB: float,
+    events: EventIndex | None = None,
+) -> RetentionEngine:
+    # motion clips are kept twice as long as the timelapse under disk pressure
+    return RetentionEngine(
+        folder=folder,
+        classes=[
+            RecordingClass(
+                file_prefix="original_", priority=2, size_limit=original_max_GB * GB
+            ),
+            RecordingClass(
+                file_prefix="hourly_", priority=1, size_limit=hourly_max_GB * GB
+            ),
+        ],
+        size_limit=recordings_max_GB * GB,
+        min_free=min_free_GB * GB,
+        events=events,
+    )
 
 
 if __name__ == "__main__":
@@ -2,14 +2,17 @@ import pathlib
 import os
 import sys
 from dataclasses import dataclass
+from typing import TYPE_CHECKING
 import logging
 from logging import getLogger
 from datetime import datetime, timedelta
 import arguably
 import requests
 import json
-import cv2
-from cv2.typing import MatLike
+from control_socket import call, is_running
+
+if TYPE_CHECKING:
+    from cv2.typing import MatLike
 
 
 if "DEBUG" in os.environ:
@@ -27,13 +30,21 @@ def main():
 
     auto_torch = AutoTorch()
 
+    # through the running controller when there is one, so that auto torch does not undo it
+
     @arguably.command
     def on():
-        auto_torch.set(True)
+        if is_running():
+            print(call("torch", on=True))
+        else:
+            auto_torch.set(True)
 
     @arguably.command
     def off():
-        auto_torch.set(False)
+        if is_running():
+            print(call("torch", on=False))
+        else:
+            auto_torch.set(False)
 
     arguably.run()
 
@@ -63,6 +74,7 @@ class AutoTorch:
         self.auth = (username, password)
         self.last_action: datetime | None = None
         self.current_on: bool | None = None
+        self.brightness: float | None = None  # of the last frame passed to `run`
 
     def set(self, on: bool) -> None:
         # use the flash light of the phone to light up the region at night
@@ -77,19 +89,23 @@ class AutoTorch:
         self.last_action = datetime.now()
         requests.get(url, auth=self.auth)
 
-    def run(self, frame: MatLike) -> None:
+    def run(self, frame: "MatLike") -> None:
+        # imported here: `on` and `off` only talk to the controller or the camera and start faster without OpenCV
+        import cv2
+
+        hsv_image = cv2.cvtColor(frame, cv2.COLOR_BGR2HSV)
+        _, _, v_channel = cv2.split(hsv_image)
+        self.brightness = v_channel.mean()
+
         if (
             self.last_action is not None
             and datetime.now() - self.last_action < timedelta(seconds=self.stable_for)
         ):
             return  # do nothing
 
-        hsv_image = cv2.cvtColor(frame, cv2.COLOR_BGR2HSV)
-        _, _, v_channel = cv2.split(hsv_image)
-        brightness = v_channel.mean()
-        if brightness < self.on_threshold and not self.current_on:
+        if self.brightness < self.on_threshold and not self.current_on:
             self.set(True)
-        elif brightness > self.off_threshold and self.current_on:
+        elif self.brightness > self.off_threshold and self.current_on:
             self.set(False)
 
 
@@ -0,0 +1,201 @@
+import pathlib
+import os
+import sys
+from concurrent.futures import ProcessPoolExecutor, as_completed
+from dataclasses import dataclass
+import logging
+from logging import getLogger
+from datetime import datetime, timedelta
+import arguably
+import cv2
+from event_index import Event, EventIndex, recording_start
+from motion_detector import MotionKernel
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+
+def main():
+
+    @arguably.command
+    def run(*, workers: int = 0, scale: float = 0.5, dry_run: bool = False):
+        """
+        index the motion events of all the recordings that have not been scanned yet; safe to interrupt and rerun
+        """
+        backfill = Backfill(
+            folder=this_dir / "recordings", workers=workers or os.cpu_count() or 1
+        )
+        backfill.run(scale=scale, dry_run=dry_run)
+
+    arguably.run()
+
+
+def lower_priority() -> None:
+    # the live detector runs on the same machine: backfill only takes the idle cycles
+    os.nice(19)
+    cv2.setNumThreads(1)  # one process per core instead of threads inside OpenCV
+
+
+def scan_original(filepath: str) -> list[tuple[str, datetime, datetime | None]]:
+    """
+    an original recording only exists because motion was detected: the file itself is the event, and its length
+    comes from the container header without decoding anything
+    """
+    path = pathlib.Path(filepath)
+    start = recording_start(path, "original_")
+    assert start is not None
+    capture = cv2.VideoCapture(filepath)
+    frames = capture.get(cv2.CAP_PROP_FRAME_COUNT)
+    fps = capture.get(cv2.CAP_PROP_FPS)
+    capture.release()
+    if not fps or fps > 120:
+        fps = 30.0  # the same as `MotionDetector.fps`
+    return [("motion", start, start + timedelta(seconds=frames / fps))]
+
+
+def scan_hourly(
+    filepath: str, scale: float
+) -> list[tuple[str, datetime, datetime | None]]:
+    """
+    an hourly recording has exactly one frame per second, which is what the live detector looks at, so running the
+    same `MotionKernel` over it reproduces the live detection; frames are downscaled first to save CPU
+    """
+    path = pathlib.Path(filepath)
+    start = recording_start(path, "hourly_")
+    assert start is not None
+    blur_size = max(3, int(21 * scale) | 1)  # the blur kernel scales with the frame
+    kernel = MotionKernel(blur_size=blur_size)
+    events: list[tuple[str, datetime, datetime | None]] = []
+    motion_start: datetime | None = None
+    capture = cv2.VideoCapture(filepath)
+    index = 0
+    now = start
+    while True:
+        ret, frame = capture.read()
+        if not ret:
+            break
+        now = start + timedelta(seconds=index)
+        index += 1
+        if scale != 1:
+            frame = cv2.resize(
+                frame, None, fx=scale, fy=scale, interpolation=cv2.INTER_AREA
+            )
+        is_motion_detected = kernel.update(frame, now)
+        if is_motion_detected and motion_start is None:
+            motion_start = now
+        elif not is_motion_detected and motion_start is not None:
+            events.append(("motion", motion_start, now))
+            motion_start = None
+    capture.release()
+    if motion_start is not None:
+        events.append(("motion", motion_start, now))
+    return events
+
+
+@dataclass
+class Backfill:
+    """
+    index the motion events of the recordings made before the event index existed, using all cores at low priority
+    - each recording is one job; the workers only decode and detect, the parent process is the only writer of the
+        event index, and each recording is marked as scanned in the same transaction as its events (checkpoint)
+    - events that overlap with what is already in the index (live detection, or an original recording that covers
+        the same motion as an hourly one) are skipped
+    """
+
+    folder: pathlib.Path
+    workers: int = 1
+
+    def pending(self, events: EventIndex) -> list[pathlib.Path]:
+        indexed = events.indexed_files()
+        # the live pipeline records events for new original recordings itself
+        live = events.event_files()
+        pending: list[pathlib.Path] = []
+        for filepath in sorted(self.folder.iterdir()):
+            if filepath.name in indexed or filepath.name in live:
+                continue
+            if filepath.name.startswith("original_"):
+                if recording_start(filepath, "original_") is not None:
+                    pending.append(filepath)
+            elif filepath.name.startswith("hourly_"):
+                start = recording_start(filepath, "hourly_")
+                # the current hour is still being written
+                if start is not None and datetime.now() - start > timedelta(hours=1):
+                    pending.append(filepath)
+        # originals first: they are cheap and take precedence over the hourly detections
+        pending.sort(key=lambda path: (not path.name.startswith("original_"), path))
+        return pending
+
+    def run(self, scale: float = 0.5, dry_run: bool = False) -> None:
+        events = EventIndex(self.folder / "events.sqlite")
+        pending = self.pending(events)
+        _LOGGER.info(
+            f"Backfilling {len(pending)} recordings with {self.workers} workers at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+        if dry_run:
+            for filepath in pending:
+                print(filepath.name)
+            return
+
+        originals = [p for p in pending if p.name.startswith("original_")]
+        hourlies = [p for p in pending if p.name.startswith("hourly_")]
+        with ProcessPoolExecutor(
+            max_workers=self.workers, initializer=lower_priority
+        ) as executor:
+            # all originals are committed before any hourly result is checked for overlap
+            for batch, job in ((originals, scan_original), (hourlies, scan_hourly)):
+                futures = {
+                    executor.submit(job, *self.arguments_of(filepath, scale)): filepath
+                    for filepath in batch
+                }
+                for done, future in enumerate(as_completed(futures), start=1):
+                    filepath = futures[future]
+                    try:
+                        found = future.result()
+                    except Exception as e:
+                        _LOGGER.error(f"Failed to backfill {filepath.name}: {e}")
+                        continue
+                    recorded = recording_start(
+                        filepath, filepath.name.split("_")[0] + "_"
+                    )
+                    found = [
+                        (kind, start, end)
+                        for kind, start, end in found
+                        if not self.overlapping(events, start, end, recorded)
+                    ]
+                    events.add_indexed_file(filepath.name, found)
+                    print(f"[{done}/{len(batch)}] {filepath.name}: {len(found)} events")
+        events.close()
+
+    @staticmethod
+    def overlapping(
+        events: EventIndex,
+        start: datetime,
+        end: datetime | None,
+        recorded: datetime | None,
+    ) -> list[Event]:
+        # an event still open from before the recording started was left open by a controller that was killed,
+        # it would otherwise cover everything found since
+        return [
+            event
+            for event in events.query(start, end or start)
+            if event.end is not None or recorded is None or event.start >= recorded
+        ]
+
+    @staticmethod
+    def arguments_of(filepath: pathlib.Path, scale: float) -> tuple:
+        if filepath.name.startswith("hourly_"):
+            return (str(filepath), scale)
+        return (str(filepath),)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,241 @@
+import pathlib
+import os
+import sys
+import subprocess
+import tempfile
+from dataclasses import dataclass
+import logging
+from logging import getLogger
+from datetime import datetime, timedelta
+import arguably
+from event_index import EventIndex, TIME_FORMAT, recording_start
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+
+def main():
+
+    exporter = ClipExporter(folder=this_dir / "recordings")
+
+    @arguably.command
+    def clip(start: str, end: str, output: str, *, accurate: bool = False):
+        """
+        export [start, end) into a standalone mp4, e.g. `clip 2025-10-05_22-27-37 2025-10-05_22-28-00 momo.mp4`
+        """
+        exporter.export(
+            parse_time(start), parse_time(end), pathlib.Path(output), accurate=accurate
+        )
+
+    @arguably.command
+    def event(
+        event_id: int, output: str, *, padding: float = 5, accurate: bool = False
+    ):
+        """
+        export the recording of an event in the event index, with some padding before and after it
+        """
+        exporter.export_event(
+            event_id, pathlib.Path(output), padding=padding, accurate=accurate
+        )
+
+    arguably.run()
+
+
+def parse_time(value: str) -> datetime:
+    try:
+        return datetime.strptime(value, TIME_FORMAT)
+    except ValueError:
+        return datetime.fromisoformat(value)
+
+
+def probe_duration(filepath: pathlib.Path) -> float:
+    command = "ffprobe -v error -show_entries format=duration -of csv=p=0".split()
+    output = subprocess.run(
+        command + [str(filepath)], check=True, capture_output=True, text=True
+    ).stdout.strip()
+    return float(output) if output and output != "N/A" else 0
+
+
+def probe_keyframes(filepath: pathlib.Path) -> list[float]:
+    # only reads the packet headers, so it does not decode any frame
+    command = "ffprobe -v error -select_streams v:0 -of csv=p=0".split()
+    command += ["-show_entries", "packet=pts_time,flags", str(filepath)]
+    output = subprocess.run(command, check=True, capture_output=True, text=True).stdout
+    keyframes: list[float] = []
+    for line in output.splitlines():
+        pts_time, _, flags = line.partition(",")
+        if "K" in flags and pts_time not in ("", "N/A"):
+            keyframes.append(float(pts_time))
+    keyframes.sort()
+    return keyframes
+
+
+def ffmpeg(*args: str) -> None:
+    command = ["ffmpeg", "-v", "error", "-y", *args]
+    _LOGGER.debug(f"Running {' '.join(command)}")
+    subprocess.run(command, check=True)
+
+
+def verify(filepath: pathlib.Path) -> None:
+    """
+    decode the whole file and raise if the decoder reported anything
+    """
+    command = ["ffmpeg", "-v", "error", "-i", str(filepath), "-f", "null", "-"]
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0 or result.stderr.strip():
+        raise RuntimeError(f"{filepath} does not decode cleanly: {result.stderr}")
+
+
+@dataclass
+class Segment:
+    filepath: pathlib.Path
+    start: float  # offset in the file, in seconds
+    end: float
+
+
+@dataclass
+class ClipExporter:
+    """
+    cut a time range out of the recordings by stream copy: the cut happens on keyframes so nothing is encoded,
+    and all the pieces come from the same encoder, so they share one SPS/PPS and concatenate into one mp4.
+    When `accurate` is set, the whole range is re-encoded in a single pass instead, so that the clip starts and
+    ends exactly at the requested time; re-encoding only the edges would mix the parameter sets of two encoders
+    in one track, which many players reject.
+    The clip is written next to the output under a temporary name, decoded once to verify it, and only then
+    renamed to the output; it is deleted if anything fails.
+    The original recordings are preferred because they are full frame rate; the hourly ones are only used when no
+    original recording covers any of the range, not to fill the gaps between the originals.
+    """
+
+    folder: pathlib.Path
+    file_prefixes: tuple[str, ...] = ("original_", "hourly_")
+
+    def segments_of(self, start: datetime, end: datetime) -> list[Segment]:
+        for prefix in self.file_prefixes:
+            segments: list[Segment] = []
+            for filepath in sorted(self.folder.iterdir()):
+                file_start = recording_start(filepath, prefix)
+                if file_start is None or file_start >= end:
+                    continue
+                # cheap rejection before probing: no recording is longer than an hour (+ slack)
+                if file_start + timedelta(hours=2) <= start:
+                    continue
+                duration = probe_duration(filepath)
+                offset_start = max(0.0, (start - file_start).total_seconds())
+                offset_end = min(duration, (end - file_start).total_seconds())
+                if offset_end > offset_start:
+                    segments.append(Segment(filepath, offset_start, offset_end))
+            if segments:
+                return segments
+        return []
+
+    def export(
+        self,
+        start: datetime,
+        end: datetime,
+        output: pathlib.Path,
+        *,
+        accurate: bool = False,
+    ) -> pathlib.Path:
+        assert end > start, "end must be after start"
+        segments = self.segments_of(start, end)
+        if not segments:
+            raise RuntimeError(f"No recording covers {start} to {end}")
+        _LOGGER.info(
+            f"Exporting {start} to {end} from {[s.filepath.name for s in segments]} at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+        partial = output.with_name(f".{output.name}.part")
+        try:
+            if accurate:
+                self.encode(segments, partial)
+            else:
+                with tempfile.TemporaryDirectory() as tmp:
+                    pieces = [
+                        self.cut(segment, pathlib.Path(tmp) / f"{index}.mp4")
+                        for index, segment in enumerate(segments)
+                    ]
+                    concat_list = pathlib.Path(tmp) / "concat.txt"
+                    concat_list.write_text(
+                        "".join(f"file '{piece}'\n" for piece in pieces)
+                    )
+                    ffmpeg(
+                        *"-f concat -safe 0 -i".split(),
+                        str(concat_list),
+                        *"-c copy -movflags +faststart -f mp4".split(),
+                        str(partial),
+                    )
+            verify(partial)
+            partial.replace(output)
+        except BaseException:
+            partial.unlink(missing_ok=True)
+            raise
+        return output
+
+    def export_event(
+        self,
+        event_id: int,
+        output: pathlib.Path,
+        *,
+        padding: float = 5,
+        accurate: bool = False,
+    ) -> pathlib.Path:
+        events = EventIndex(self.folder / "events.sqlite")
+        event = events.get(event_id)
+        events.close()
+        if event is None:
+            raise RuntimeError(f"Event {event_id} not found")
+        end = event.end or datetime.now()
+        return self.export(
+            event.start - timedelta(seconds=padding),
+            end + timedelta(seconds=padding),
+            output,
+            accurate=accurate,
+        )
+
+    def cut(self, segment: Segment, output: pathlib.Path) -> pathlib.Path:
+        keyframes = probe_keyframes(segment.filepath)
+        # snap down to the keyframe at or before the start so that the first frame decodes
+        before = [t for t in keyframes if t <= segment.start]
+        start = before[-1] if before else 0.0
+        ffmpeg(
+            "-ss",
+            f"{start:.6f}",
+            "-i",
+            str(segment.filepath),
+            "-t",
+            f"{segment.end - start:.6f}",
+            *"-map 0:v:0 -c copy -avoid_negative_ts make_zero".split(),
+            str(output),
+        )
+        return output
+
+    @staticmethod
+    def encode(segments: list[Segment], output: pathlib.Path) -> None:
+        # one input per segment, each decoded from its own offset, and a single libx264 pass over all of them so
+        # that the clip has one parameter set
+        inputs: list[str] = []
+        for segment in segments:
+            inputs += ["-ss", f"{segment.start:.6f}"]
+            inputs += ["-t", f"{segment.end - segment.start:.6f}"]
+            inputs += ["-i", str(segment.filepath)]
+        streams = "".join(f"[{index}:v:0]" for index in range(len(segments)))
+        ffmpeg(
+            *inputs,
+            "-filter_complex",
+            f"{streams}concat=n={len(segments)}:v=1:a=0[v]",
+            *"-map [v] -c:v libx264 -preset veryfast -crf 18 -pix_fmt yuv420p".split(),
+            *"-movflags +faststart -f mp4".split(),
+            str(output),
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,161 @@
+import os
+import sys
+import json
+import socket
+import asyncio
+import pathlib
+import inspect
+from typing import Any, Callable
+import logging
+from logging import getLogger
+from datetime import datetime
+import arguably
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+SOCKET_PATH = this_dir / "approach_feeder.sock"
+
+
+def main():
+    # thin commands: only the standard library is imported, the running daemon does the work with its warm session
+
+    @arguably.command
+    def feed(*, plate: int = 1, seconds: float = 120):
+        """
+        open the plate for at least `seconds`; it closes like any feed once nothing moves
+        """
+        print(call("feed", plate=plate, seconds=seconds))
+
+    @arguably.command
+    def close(*, seconds: float = 60):
+        """
+        close the plate now and ignore motion for `seconds`, so that whoever closed it does not open it again
+        """
+        print(call("close", seconds=seconds))
+
+    @arguably.command
+    def torch(state: str):
+        """
+        turn the torch of the camera `on` or `off` (auto torch leaves it alone for an hour)
+        """
+        print(call("torch", on=state == "on"))
+
+    @arguably.command
+    def state():
+        """
+        print the state of the controller
+        """
+        print(json.dumps(call("state"), indent=2))
+
+    arguably.run()
+
+
+def call(command: str, path: pathlib.Path = SOCKET_PATH, timeout: float = 10, **args):
+    """
+    run `command` in the daemon and return its result; raises `ConnectionError` (or `FileNotFoundError`) when the
+    daemon does not run, and `RuntimeError` when the command failed
+    """
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as client:
+        client.settimeout(timeout)
+        client.connect(str(path))
+        client.sendall(json.dumps({"command": command, "args": args}).encode() + b"\n")
+        with client.makefile("rb") as reader:
+            line = reader.readline()
+    if not line:
+        raise ConnectionError("the daemon closed the connection")
+    response = json.loads(line)
+    if not response["ok"]:
+        raise RuntimeError(response["error"])
+    return response["result"]
+
+
+def is_running(path: pathlib.Path = SOCKET_PATH) -> bool:
+    try:
+        call("ping", path=path, timeout=1)
+        return True
+    except (OSError, RuntimeError):
+        return False
+
+
+class ControlServer:
+    """
+    the local control plane of the running `approach_feeder.py`: one JSON request per line on a Unix socket
+    (`{"command": "close", "args": {}}`), answered by one JSON line (`{"ok": true, "result": ...}`)
+    - the handlers run on the loop of the controller, so they reuse its cloud session and change its state directly
+        instead of fighting it from another process
+    - the socket is only accessible to the user running the daemon
+    """
+
+    def __init__(self, path: pathlib.Path = SOCKET_PATH):
+        self.path = path
+        self.handlers: dict[str, Callable[..., Any]] = {"ping": lambda: "pong"}
+        self.server: asyncio.AbstractServer | None = None
+
+    def add(self, name: str, handler: Callable[..., Any]) -> None:
+        self.handlers[name] = handler
+
+    async def start(self) -> None:
+        if self.path.exists():
+            # the kernel accepts the connection of a live server even before it answers
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as probe:
+                try:
+                    probe.connect(str(self.path))
+                except ConnectionRefusedError:
+                    # left over by a daemon that was killed
+                    self.path.unlink()
+                else:
+                    raise RuntimeError(f"Another controller listens on {self.path}")
+        # created without access for others, rather than restricted after it was already listening
+        umask = os.umask(0o177)
+        try:
+            self.server = await asyncio.start_unix_server(
+                self.handle, path=str(self.path)
+            )
+        finally:
+            os.umask(umask)
+
+    def stop(self) -> None:
+        if self.server is not None:
+            self.server.close()
+        self.path.unlink(missing_ok=True)
+
+    async def handle(
+        self, reader: asyncio.StreamReader, writer: asyncio.StreamWriter
+    ) -> None:
+        try:
+            while line := await reader.readline():
+                writer.write(json.dumps(await self.run(line)).encode() + b"\n")
+                await writer.drain()
+        except ConnectionResetError:
+            pass
+        finally:
+            writer.close()
+
+    async def run(self, line: bytes) -> dict[str, Any]:
+        try:
+            request = json.loads(line)
+            handler = self.handlers[request["command"]]
+            result = handler(**request.get("args", {}))
+            if inspect.isawaitable(result):
+                result = await result
+            if request["command"] not in ("ping", "state"):  # read-only, and polled
+                _LOGGER.info(
+                    f"Control command {request['command']} at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+            return {"ok": True, "result": result}
+        except Exception as e:
+            return {"ok": False, "error": f"{type(e).__name__}: {e}"}
+
+
+if __name__ == "__main__":
+    main()
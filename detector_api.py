@@ -0,0 +1,140 @@
+import os
+import sys
+import asyncio
+import logging
+from logging import getLogger
+from datetime import date
+from typing import Any
+import cv2
+from cv2.typing import MatLike
+from aiohttp import web
+from motion_detector import MotionDetector
+from detector_process import DetectorProcess
+from motion_heatmap import MotionHeatmap
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+def encode_jpeg(frame: MatLike, quality: int) -> bytes:
+    ret, buffer = cv2.imencode(".jpg", frame, [cv2.IMWRITE_JPEG_QUALITY, quality])
+    assert ret, "Failed to encode the snapshot"
+    return buffer.tobytes()
+
+
+def encode_heatmap(counts: MatLike, raw: bool) -> bytes:
+    image = counts if raw else MotionHeatmap.render(counts)
+    ret, buffer = cv2.imencode(".png", image)
+    assert ret, "Failed to encode the heatmap"
+    return buffer.tobytes()
+
+
+class SnapshotCache:
+    """
+    the JPEG of the annotated frame is encoded lazily, at most once per generation (the detector produces a new one
+    every second), and the same encoding is shared by every request: while one encoding is in flight, the other
+    requests for that generation wait for it instead of starting their own
+    """
+
+    def __init__(self, quality: int = 80):
+        self.quality = quality
+        self.generation = -1
+        self.encoding: asyncio.Future[bytes] | None = None
+
+    async def get(self, generation: int, frame: MatLike) -> bytes:
+        if self.encoding is None or self.generation != generation:
+            self.generation = generation
+            # the encoding runs in a worker thread so it never blocks the control loop
+            self.encoding = asyncio.get_running_loop().run_in_executor(
+                None, encode_jpeg, frame, self.quality
+            )
+        # shielded: a client that disconnects must not cancel the encoding for the others
+        return await asyncio.shield(self.encoding)
+
+
+class DetectorAPI:
+    """
+    what the detector sees, for dashboards on the local network
+    - GET /state: the detector and controller state, as JSON
+    - GET /events?count=20: the most recent events of the event index
+    - GET /snapshot.jpg: the latest frame with the motion boxes drawn on it
+    - GET /heatmap.png?day=2025-10-05: where the motion happened that day (today by default); `raw=1` returns the
+        16-bit counts instead of the colorized image
+    """
+
+    def __init__(self, detector: MotionDetector | DetectorProcess):
+        self.detector = detector
+        self.snapshots = SnapshotCache()
+        # updated by the controller every second, e.g. `is_feeding`
+        self.state: dict[str, Any] = {}
+
+    def add_routes(self, app: web.Application) -> None:
+        app.router.add_get("/state", self.handle_state)
+        app.router.add_get("/events", self.handle_events)
+        app.router.add_get("/snapshot.jpg", self.handle_snapshot)
+        app.router.add_get("/heatmap.png", self.handle_heatmap)
+
+    async def handle_state(self, request: web.Request) -> web.Response:
+        detector = self.detector
+        return web.json_response(
+            {
+                "is_motion_detected": detector.is_motion_detected,
+                "capture_ok": detector.capture_ok,
+                "frames_read": detector.frames_read,
+                "snapshot_generation": detector.snapshot[0],
+                **self.state,
+            }
+        )
+
+    async def handle_events(self, request: web.Request) -> web.Response:
+        try:
+            count = min(int(request.query.get("count", 20)), 1000)
+        except ValueError:
+            raise web.HTTPBadRequest(text="count must be a number")
+        events = self.detector.events.recent(count)
+        return web.json_response(
+            [
+                {
+                    "id": event.id,
+                    "kind": event.kind,
+                    "start": event.start.timestamp(),
+                    "end": event.end and event.end.timestamp(),
+                    "file": event.file,
+                    "pinned": event.pinned,
+                }
+                for event in events
+            ]
+        )
+
+    async def handle_snapshot(self, request: web.Request) -> web.StreamResponse:
+        # read once: the detector swaps the tuple as a whole
+        generation, frame = self.detector.snapshot
+        if frame is None:
+            raise web.HTTPServiceUnavailable(text="no frame yet")
+        etag = f'"{generation}"'
+        headers = {"ETag": etag, "Cache-Control": "no-cache"}
+        if request.headers.get("If-None-Match") == etag:
+            return web.Response(status=304, headers=headers)
+        body = await self.snapshots.get(generation, frame)
+        return web.Response(body=body, content_type="image/jpeg", headers=headers)
+
+    async def handle_heatmap(self, request: web.Request) -> web.Response:
+        day: date | None = None
+        try:
+            if "day" in request.query:
+                day = date.fromisoformat(request.query["day"])
+        except ValueError:
+            raise web.HTTPBadRequest(text="day must be YYYY-MM-DD")
+        raw = request.query.get("raw") == "1"
+        counts = self.detector.heatmap.get(day)
+        if counts is None:
+            raise web.HTTPNotFound(text="no heatmap for that day")
+        body = await asyncio.get_running_loop().run_in_executor(
+            None, encode_heatmap, counts, raw
+        )
+        return web.Response(body=body, content_type="image/png")
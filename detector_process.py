@@ -0,0 +1,490 @@
+import pathlib
+import os
+import sys
+import time
+import signal
+import struct
+import zlib
+import multiprocessing
+from multiprocessing.shared_memory import SharedMemory
+from threading import Thread, Event as ThreadEvent
+import logging
+from logging import getLogger
+from datetime import datetime
+import numpy as np
+from cv2.typing import MatLike
+from event_index import EventIndex
+from motion_heatmap import MotionHeatmap
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+# layout of the shared memory: a header, the event queue and the frame (with the motion boxes drawn on it)
+# - the tick fields are written by the detector thread of the child under the seqlock `SEQ`
+# - the health fields are written by the main thread of the child only, every `HEARTBEAT` seconds
+# - the queue head is written by the parent only, the queue tail by the child only
+# - nothing orders the stores of one process as seen by the other (plain memcpy into the mapping; on ARM they may
+#   become visible out of order), so the payloads carry a CRC-32 that the reader checks instead of trusting the order
+SEQ = 0  # uint64, odd while a tick is being published
+GENERATION = 8  # uint64, continues across restarts so that the ETags stay unique
+MOTION = 16  # uint8
+PUBLISH_US = 24  # float64, time spent copying the last tick into shared memory
+IDENTITY = 32  # utf-8, zero-padded: who is moving (see `appearance.py`)
+IDENTITY_LENGTH = 32
+HEARTBEAT_AT = 64  # float64, time.time() of the last heartbeat
+FRAMES_READ = 72  # uint64
+CAPTURE_OK = 80  # uint8
+APPEARANCE_US = 88  # float64, time spent on the appearance signature of the last tick
+PEAK_RSS_MB = 96  # float64, the high-water mark of the resident memory of the child
+TICK_CRC = 104  # uint32, of the generation, the motion and the identity of the tick
+FRAME_CRC = 108  # uint32, of the frame of the tick
+QUEUE_HEAD = 128  # uint64, next record to read
+QUEUE_TAIL = 136  # uint64, next record to write
+QUEUE_DROPPED = 144  # uint64
+QUEUE = 256
+QUEUE_SLOTS = 256
+RECORD = struct.Struct("<Qdi")  # sequence (index + 1), timestamp, kind
+RECORD_CRC = struct.Struct("<I")  # follows the record
+RECORD_SIZE = RECORD.size + RECORD_CRC.size
+FRAME = 8192
+
+MOTION_START = 1
+MOTION_END = 2
+
+HEARTBEAT = 0.5
+# the detector thread iterates at least once a second (every frame, or every retry while the camera is down);
+# opening the stream again may block for a while, longer than that it is stuck
+PROGRESS_TIMEOUT = 20
+
+
+def main():
+    # run the detector alone in its supervised process and print what the parent sees
+    with DetectorProcess() as detector:
+        while True:
+            time.sleep(1)
+            detector.poll()
+            print(
+                f"motion: {detector.is_motion_detected}, capture_ok: {detector.capture_ok}, "
+                f"frames_read: {detector.frames_read}, ipc_us: {detector.ipc_us:.0f}, "
+                f"restarts: {detector.restarts}, last_restart_seconds: {detector.last_restart_seconds}, "
+                f"peak_rss_mb: {detector.peak_rss_mb:.0f}"
+            )
+
+
+class SharedState:
+    """
+    the views of both processes on the shared memory, see the layout above
+    - the annotated frame and the motion state are published as a seqlock: the writer makes the sequence odd,
+        copies, and makes it even again; the reader copies and retries if the sequence was odd or changed meanwhile,
+        or if the copy does not match its CRC, so neither side ever takes a lock and a crashed writer can never
+        block the reader
+    - the events go through a single-producer single-consumer ring; each record carries its own sequence number
+        and a CRC, so the reader never takes a half-written or not yet visible record
+    - the CRCs cost ~3ms per 1080p frame on each side, once per second
+    """
+
+    def __init__(self, shm: SharedMemory, width: int, height: int):
+        self.shm = shm
+        self.buf = shm.buf
+        self.shape = (height, width, 3)
+        self.frame = np.ndarray(
+            self.shape, dtype=np.uint8, buffer=shm.buf, offset=FRAME
+        )
+
+    @staticmethod
+    def size_of(width: int, height: int) -> int:
+        return FRAME + height * width * 3
+
+    def get(self, fmt: str, offset: int):
+        return struct.unpack_from(fmt, self.buf, offset)[0]
+
+    def set(self, fmt: str, offset: int, value) -> None:
+        struct.pack_into(fmt, self.buf, offset, value)
+
+    @staticmethod
+    def tick_crc(generation: int, motion: bool, identity: bytes) -> int:
+        return zlib.crc32(struct.pack("<QB", generation, motion) + identity)
+
+    def read_tick(self) -> tuple[int, bool, bytes, int]:
+        # generation, motion, identity (zero-padded) and the CRC the writer computed for them
+        return (
+            self.get("<Q", GENERATION),
+            bool(self.get("<B", MOTION)),
+            bytes(self.buf[IDENTITY : IDENTITY + IDENTITY_LENGTH]),
+            self.get("<I", TICK_CRC),
+        )
+
+    def close(self) -> None:
+        # the numpy views export the buffer, `close` fails while they exist
+        del self.frame
+        self.buf = None
+        self.shm.close()
+
+    # the writer side (child)
+
+    def publish(self, frame: MatLike, motion: bool, identity: str | None) -> None:
+        started = time.perf_counter()
+        seq = self.get("<Q", SEQ)
+        seq += seq % 2  # a previous child killed in the middle of a publish left it odd
+        self.set("<Q", SEQ, seq + 1)
+        np.copyto(self.frame, frame)
+        self.set("<B", MOTION, motion)
+        encoded = (
+            (identity or "").encode()[:IDENTITY_LENGTH].ljust(IDENTITY_LENGTH, b"\0")
+        )
+        self.buf[IDENTITY : IDENTITY + IDENTITY_LENGTH] = encoded
+        generation = self.get("<Q", GENERATION) + 1
+        self.set("<Q", GENERATION, generation)
+        self.set("<I", TICK_CRC, self.tick_crc(generation, motion, encoded))
+        self.set("<I", FRAME_CRC, zlib.crc32(frame))
+        self.set("<Q", SEQ, seq + 2)
+        self.set("<d", PUBLISH_US, (time.perf_counter() - started) * 1e6)
+
+    def push(self, kind: int, timestamp: float) -> bool:
+        tail = self.get("<Q", QUEUE_TAIL)
+        if tail - self.get("<Q", QUEUE_HEAD) >= QUEUE_SLOTS:
+            # the parent is not reading: drop rather than block the detector
+            self.set("<Q", QUEUE_DROPPED, self.get("<Q", QUEUE_DROPPED) + 1)
+            return False
+        offset = QUEUE + (tail % QUEUE_SLOTS) * RECORD_SIZE
+        record = RECORD.pack(tail + 1, timestamp, kind)
+        self.buf[offset : offset + RECORD_SIZE] = record + RECORD_CRC.pack(
+            zlib.crc32(record)
+        )
+        self.set("<Q", QUEUE_TAIL, tail + 1)
+        return True
+
+    # the reader side (parent)
+
+    def read(self, frame: np.ndarray, attempts: int = 3) -> tuple[int, bool] | None:
+        """
+        copy the frame into `frame`; returns (generation, motion), or None if no consistent copy was made
+        """
+        for _ in range(attempts):
+            seq = self.get("<Q", SEQ)
+            if seq % 2 == 1:
+                time.sleep(0.001)
+                continue
+            np.copyto(frame, self.frame)
+            generation, motion, identity, tick_crc = self.read_tick()
+            frame_crc = self.get("<I", FRAME_CRC)
+            if self.get("<Q", SEQ) != seq:
+                continue
+            if tick_crc == self.tick_crc(
+                generation, motion, identity
+            ) and frame_crc == zlib.crc32(frame):
+                return generation, motion
+        return None
+
+    def read_identity(self, attempts: int = 3) -> str | None:
+        # same seqlock as `read`, without the frame
+        for _ in range(attempts):
+            seq = self.get("<Q", SEQ)
+            if seq % 2 == 1:
+                continue
+            generation, motion, encoded, tick_crc = self.read_tick()
+            if self.get("<Q", SEQ) != seq:
+                continue
+            if tick_crc == self.tick_crc(generation, motion, encoded):
+                return encoded.rstrip(b"\0").decode(errors="replace") or None
+        return None
+
+    def pop(self) -> list[tuple[int, float]]:
+        head = self.get("<Q", QUEUE_HEAD)
+        records: list[tuple[int, float]] = []
+        while head < self.get("<Q", QUEUE_TAIL):
+            offset = QUEUE + (head % QUEUE_SLOTS) * RECORD_SIZE
+            record = bytes(self.buf[offset : offset + RECORD.size])
+            (crc,) = RECORD_CRC.unpack_from(self.buf, offset + RECORD.size)
+            sequence, timestamp, kind = RECORD.unpack(record)
+            if sequence != head + 1 or crc != zlib.crc32(record):
+                break  # the tail moved before the record was visible, read it next time
+            records.append((kind, timestamp))
+            head += 1
+        self.set("<Q", QUEUE_HEAD, head)
+        return records
+
+
+def run_detector(
+    shm_name: str, ip_port: str, width: int, height: int, capture_url: str | None
+) -> None:
+    """
+    the entry point of the child process: the `MotionDetector` thread publishes every tick, and the main thread
+    writes the heartbeat until the parent goes away or asks to stop (SIGTERM)
+    - the heartbeat only goes on while the detector thread makes progress: when it died (an exception) the child
+        exits, when it is stuck (e.g. in `capture.read()`) the heartbeat stops and the supervisor restarts the child
+    """
+    from motion_detector import MotionDetector, peak_rss_mb
+
+    stopped = ThreadEvent()
+    signal.signal(signal.SIGTERM, lambda signum, frame: stopped.set())
+    shared = SharedState(SharedMemory(name=shm_name), width=width, height=height)
+    was_motion_detected = False
+
+    def on_tick(detector: MotionDetector) -> None:
+        nonlocal was_motion_detected
+        # the boxes are drawn on the frame itself: the snapshot is also what auto torch looks at
+        _, frame = detector.snapshot
+        if frame is None:
+            return
+        if detector.is_motion_detected != was_motion_detected:
+            was_motion_detected = detector.is_motion_detected
+            shared.push(
+                MOTION_START if was_motion_detected else MOTION_END, time.time()
+            )
+        shared.set("<d", APPEARANCE_US, detector.appearance_us)
+        shared.publish(frame, detector.is_motion_detected, detector.identity)
+
+    with MotionDetector(
+        ip_port=ip_port, width=width, height=height, capture_url=capture_url
+    ) as detector:
+        detector.on_tick = on_tick
+        parent = multiprocessing.parent_process()
+        while not stopped.is_set() and (parent is None or parent.is_alive()):
+            if not detector.thread.is_alive():
+                _LOGGER.error(
+                    "Detector thread died at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+                os._exit(1)
+            shared.set("<Q", FRAMES_READ, detector.frames_read)
+            shared.set("<B", CAPTURE_OK, detector.capture_ok)
+            shared.set("<d", PEAK_RSS_MB, peak_rss_mb())
+            if time.time() - detector.progress_at < PROGRESS_TIMEOUT:
+                shared.set("<d", HEARTBEAT_AT, time.time())
+            stopped.wait(HEARTBEAT)
+        _LOGGER.info(
+            "Detector process stopping at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+    # the detector thread never returns by itself
+    os._exit(0)
+
+
+class DetectorProcess:
+    """
+    `MotionDetector` in its own process, so that its Python work never holds the GIL of the control loop and a
+    crash of OpenCV or of the detector only costs a restart
+    - it has the same attributes as `MotionDetector` for the controller and `DetectorAPI` (`is_motion_detected`,
+        `capture_ok`, `frames_read`, `identity`, `frame`, `snapshot`, `events`, `heatmap`); the controller calls
+        `poll` once per loop to refresh them
+    - a motion that starts and ends between two polls is still reported once, through the event queue
+    - the supervisor thread restarts the child when it exits, when its heartbeat stops for `stall_timeout` seconds
+        or when it does not connect to the camera within `start_timeout` seconds, with a backoff when it keeps
+        crashing; `last_restart_seconds` is the time from the failure to the first frame of the new child
+    - `ipc_us` is the time spent on the shared memory for the last second: the copy of the child, the poll and
+        the copy of the parent (at most one per second)
+    - the heatmap of today is read from the file the child saves every 10 minutes, so it lags by as much
+    """
+
+    def __init__(
+        self,
+        ip_port: str = "192.168.0.91:8080",
+        height: int = 1080,
+        width: int = 1920,
+        stall_timeout: float = 10,
+        start_timeout: float = 120,
+        capture_url: str | None = None,  # see `MotionDetector`
+    ):
+        self.ip_port = ip_port
+        self.capture_url = capture_url
+        self.width = width
+        self.height = height
+        self.stall_timeout = stall_timeout
+        self.start_timeout = start_timeout
+        # spawn: never fork the asyncio loop and its threads
+        self.context = multiprocessing.get_context("spawn")
+        self.shm = SharedMemory(create=True, size=SharedState.size_of(width, height))
+        self.shm.buf[:FRAME] = bytes(FRAME)
+        self.shared = SharedState(self.shm, width=width, height=height)
+        self.process: multiprocessing.process.BaseProcess | None = None
+        self.spawned_at = 0.0
+        self.stopped = ThreadEvent()
+
+        # the same database as the child: sqlite serializes the writers of both processes
+        self.events = EventIndex()
+        self.heatmap = MotionHeatmap()
+        self.close_open_events(
+            since=0, at=None
+        )  # left by the detector of a previous run
+
+        self.is_motion_detected = False
+        self.identity: str | None = None
+        self.appearance_us: float = 0
+        self.peak_rss_mb: float = 0  # of the detector process
+        self.capture_ok = False
+        self.frames_read = 0
+        self.ipc_us: float = 0
+        self.copy_us: float = 0
+        self.restarts = 0
+        self.last_restart_seconds: float | None = None
+        self.failed_at: float | None = None
+
+        self.generation = 0  # seen by the last poll
+        self.snapshot_generation = 0
+        self.snapshot_buffer: MatLike | None = None
+
+    def __enter__(self) -> "DetectorProcess":
+        self.spawn()
+        self.supervisor = Thread(target=self._supervisor_function, daemon=True)
+        self.supervisor.start()
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback) -> None:
+        self.stopped.set()
+        if self.process is not None:
+            self.process.terminate()
+            self.process.join(timeout=10)
+            if self.process.is_alive():
+                self.process.kill()
+        self.shared.close()
+        self.shm.unlink()
+
+    def spawn(self) -> None:
+        self.process = self.context.Process(
+            target=run_detector,
+            args=(
+                self.shm.name,
+                self.ip_port,
+                self.width,
+                self.height,
+                self.capture_url,
+            ),
+            name="motion_detector",
+            daemon=True,
+        )
+        self.spawned_at = time.time()
+        self.process.start()
+
+    def _supervisor_function(self) -> None:
+        backoff = 1.0
+        while not self.stopped.wait(1):
+            assert self.process is not None
+            heartbeat_at = self.shared.get("<d", HEARTBEAT_AT)
+            alive = self.process.is_alive()
+            # the child only starts beating once it is connected to the camera
+            if heartbeat_at > 0:
+                stalled = time.time() - heartbeat_at > self.stall_timeout
+            else:
+                stalled = time.time() - self.spawned_at > self.start_timeout
+            if alive and not stalled:
+                if self.failed_at is None:
+                    backoff = 1.0
+                continue
+            if self.failed_at is None:
+                self.failed_at = time.time()
+            _LOGGER.error(
+                ("Detector process stalled" if alive else "Detector process exited")
+                + f" (exit code {self.process.exitcode}), restarting in {backoff:.0f}s at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+            if alive:
+                self.process.kill()
+            self.process.join()
+            self.close_open_events(
+                since=self.spawned_at, at=heartbeat_at or time.time()
+            )
+            self.shared.set("<d", HEARTBEAT_AT, 0)
+            self.shared.set("<B", CAPTURE_OK, 0)
+            seq = self.shared.get("<Q", SEQ)
+            self.shared.set("<Q", SEQ, seq + seq % 2)
+            if self.stopped.wait(backoff):
+                return
+            backoff = min(backoff * 2, 60)
+            self.restarts += 1
+            self.spawn()
+
+    def close_open_events(self, since: float, at: float | None) -> None:
+        """
+        end the motion events that a dead child started after `since` and never ended, at `at` (its last heartbeat),
+        or when `at` is None at the last write of their recording; otherwise they stay open forever and overlap
+        every later query (timeline, backfill, clip export)
+        """
+        folder = this_dir / "recordings"
+        for event in self.events.open_events("motion"):
+            if event.start.timestamp() < since:
+                continue
+            end = at
+            if end is None:
+                recording = folder / event.file if event.file else None
+                exists = recording is not None and recording.exists()
+                end = recording.stat().st_mtime if exists else event.start.timestamp()
+            end = max(end, event.start.timestamp())
+            self.events.end(event.id, datetime.fromtimestamp(end))
+            _LOGGER.info(
+                f"Closed the motion event {event.id} left open by the detector at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+
+    def poll(self) -> None:
+        """
+        refresh the state from the shared memory; called by the controller once per loop
+        """
+        started = time.perf_counter()
+        motion_started = False
+        for kind, _ in self.shared.pop():
+            if kind == MOTION_START:
+                motion_started = True
+        self.is_motion_detected = bool(self.shared.get("<B", MOTION)) or motion_started
+        self.identity = self.shared.read_identity()
+        self.appearance_us = self.shared.get("<d", APPEARANCE_US)
+        self.peak_rss_mb = self.shared.get("<d", PEAK_RSS_MB)
+        self.frames_read = self.shared.get("<Q", FRAMES_READ)
+        self.capture_ok = (
+            bool(self.shared.get("<B", CAPTURE_OK))
+            and self.process is not None
+            and self.process.is_alive()
+        )
+        generation = self.shared.get("<Q", GENERATION)
+        if (
+            self.failed_at is not None
+            and generation != self.generation
+            and self.capture_ok
+        ):
+            # the first frame of the new child
+            self.last_restart_seconds = time.time() - self.failed_at
+            self.failed_at = None
+            _LOGGER.info(
+                f"Detector process restarted in {self.last_restart_seconds:.1f}s at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+        self.generation = generation
+        poll_us = (time.perf_counter() - started) * 1e6
+        self.ipc_us = self.shared.get("<d", PUBLISH_US) + poll_us + self.copy_us
+
+    @property
+    def frame(self) -> MatLike | None:
+        # as in `MotionDetector`, the boxes are drawn on the frame
+        return self.snapshot[1]
+
+    @property
+    def snapshot(self) -> tuple[int, MatLike | None]:
+        """
+        (generation, annotated frame); copied out of the shared memory at most once per generation, into a new
+        array since `DetectorAPI` encodes it in another thread
+        """
+        generation = self.shared.get("<Q", GENERATION)
+        if generation == 0:
+            return (0, None)
+        if self.snapshot_buffer is None or self.snapshot_generation != generation:
+            started = time.perf_counter()
+            frame = np.empty(self.shared.shape, dtype=np.uint8)
+            read = self.shared.read(frame)
+            self.copy_us = (time.perf_counter() - started) * 1e6
+            if read is None:
+                return (self.snapshot_generation, self.snapshot_buffer)
+            self.snapshot_generation, _ = read
+            self.snapshot_buffer = frame
+        return (self.snapshot_generation, self.snapshot_buffer)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,42 +1,419 @@
-
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include <WebServer.h>
 #include <ESPmDNS.h>
+#include <Preferences.h>
 #include "password.hpp"
 
+const uint16_t FIRMWARE_VERSION = 2; // bumped with every release, sent in the heartbeat
+
 const int LED_PIN = LED_BUILTIN;
+// the pins and timings below are the defaults of `config`, see /config
 const int MEAL_PIN = 9; // green line -> GPIO9 / D10
-unsigned long meal_count = 0;
+volatile unsigned long meal_count = 0;
 const int SNACK_PIN = 8; // white line -> GPIO8 / D9
-unsigned long snack_count = 0;
+volatile unsigned long snack_count = 0;
+
+// presses on the feeder's own buttons (also included in the counts above)
+volatile unsigned long manual_meal_count = 0;
+volatile unsigned long manual_snack_count = 0;
 
 // example:
 // 4.00s: press the button
 // 6.00s: the machine starts to dispense the meal (the be safe, wait for 4s)
 // 12.00s: the machine is ready for the next command
 
-unsigned long previous_feed = 0;
+uint32_t previous_feed = 0; // 32 bits like millis(), so the elapsed time stays right when millis() wraps
 const unsigned long feed_interval = 8000;  // 8 seconds
 const unsigned long press_duration = 4000; // 4 seconds
+const unsigned long debounce_duration = 30; // ms, see the manual presses below
+
+// runtime config: persisted as one binary blob in NVS, loaded into RAM once at boot, and read as plain fields.
+// new fields are only ever appended (and CONFIG_VERSION bumped), so an older blob is a prefix of the new struct
+// and keeps its values while the new fields get their defaults.
+const uint16_t CONFIG_VERSION = 1;
+
+struct __attribute__((packed)) Config
+{
+  uint16_t version;
+  uint32_t feed_interval;     // ms between two feeds
+  uint32_t press_duration;    // ms the button is held
+  uint32_t debounce_duration; // ms of quiet before a manual press is read
+  uint8_t meal_pin;
+  uint8_t snack_pin;
+  char mdns_name[32];
+};
+
+Config config = {CONFIG_VERSION, feed_interval, press_duration, debounce_duration, MEAL_PIN, SNACK_PIN, "dry_feeder"};
+Preferences preferences;
+
+void load_config()
+{
+  preferences.begin("dry_feeder", false);
+  size_t length = preferences.getBytesLength("config");
+  Config stored;
+  if (length >= sizeof(stored.version) && length <= sizeof(stored) &&
+      preferences.getBytes("config", &stored, length) == length && stored.version <= CONFIG_VERSION)
+  {
+    memcpy(&config, &stored, length); // the fields after `length` keep their defaults
+    config.version = CONFIG_VERSION;
+    Serial.println("config loaded from NVS");
+  }
+  else if (length > 0)
+  {
+    Serial.println("config in NVS is invalid or newer than the firmware, using the defaults");
+  }
+}
+
+bool save_config()
+{
+  return preferences.putBytes("config", &config, sizeof(config)) == sizeof(config);
+}
 
 WebServer server(80);
 
+// event log: the last EVENT_LOG_SIZE feeds, written from the handlers and from the timer interrupt
+enum EventType : uint8_t
+{
+  EVENT_MEAL,
+  EVENT_SNACK,
+  EVENT_MANUAL_MEAL,
+  EVENT_MANUAL_SNACK,
+};
+const char *event_names[] = {"meal", "snack", "manual_meal", "manual_snack"};
+
+struct LogEvent
+{
+  unsigned long at; // millis()
+  EventType type;
+};
+
+const int EVENT_LOG_SIZE = 64;
+LogEvent event_log[EVENT_LOG_SIZE];
+volatile unsigned long event_count = 0; // total, the next one goes to event_count % EVENT_LOG_SIZE
+portMUX_TYPE event_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void IRAM_ATTR log_event_locked(EventType type)
+{
+  LogEvent &event = event_log[event_count % EVENT_LOG_SIZE];
+  event.at = millis();
+  event.type = type;
+  event_count += 1;
+}
+
+// the counters are saved to NVS so they survive a brownout: before a feed is answered, and for the manual presses
+// (counted in an interrupt, which cannot write to flash) by loop() or before the next page that shows them
+volatile bool counts_dirty = false;
+
+void load_counts()
+{
+  meal_count = preferences.getULong("meal_count", 0);
+  snack_count = preferences.getULong("snack_count", 0);
+  manual_meal_count = preferences.getULong("manual_meal", 0);
+  manual_snack_count = preferences.getULong("manual_snack", 0);
+}
+
+void save_counts()
+{
+  counts_dirty = false;
+  preferences.putULong("meal_count", meal_count);
+  preferences.putULong("snack_count", snack_count);
+  preferences.putULong("manual_meal", manual_meal_count);
+  preferences.putULong("manual_snack", manual_snack_count);
+}
+
+void count_feed(volatile unsigned long &count, EventType type)
+{
+  portENTER_CRITICAL(&event_mux);
+  count += 1;
+  log_event_locked(type);
+  portEXIT_CRITICAL(&event_mux);
+  save_counts();
+}
+
+// retries: a client that times out during the blocking feed handler (or loses WiFi before the answer) retries
+// with the same `id`, and an id that was already fed is answered without pressing again. the ids are saved to NVS
+// before pressing, so a retry after a brownout mid-press does not press twice either: at most once, a feed cut by
+// a brownout is lost rather than doubled.
+const int RECENT_IDS = 8;
+const int ID_LENGTH = 24; // with the terminating 0
+
+struct __attribute__((packed)) RecentIds
+{
+  uint8_t next;
+  char ids[RECENT_IDS][ID_LENGTH];
+};
+
+RecentIds recent_ids = {};
+
+void load_recent_ids()
+{
+  if (preferences.getBytesLength("recent_ids") == sizeof(recent_ids))
+  {
+    preferences.getBytes("recent_ids", &recent_ids, sizeof(recent_ids));
+    recent_ids.next %= RECENT_IDS;
+  }
+}
+
+bool is_recent_id(const String &id)
+{
+  for (int i = 0; i < RECENT_IDS; i++)
+  {
+    if (id.length() > 0 && strncmp(recent_ids.ids[i], id.c_str(), ID_LENGTH) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void remember_id(const String &id)
+{
+  if (id.length() == 0)
+  {
+    return;
+  }
+  strncpy(recent_ids.ids[recent_ids.next], id.c_str(), ID_LENGTH - 1);
+  recent_ids.ids[recent_ids.next][ID_LENGTH - 1] = '\0';
+  recent_ids.next = (recent_ids.next + 1) % RECENT_IDS;
+  preferences.putBytes("recent_ids", &recent_ids, sizeof(recent_ids));
+}
+
+// the id of a feed request: empty when not given; false (answered with 400) if it is too long to be remembered
+bool parse_id(String &id)
+{
+  id = server.arg("id");
+  if (id.length() >= (unsigned int)ID_LENGTH)
+  {
+    server.send(400, "text/plain", "id must have at most " + String(ID_LENGTH - 1) + " characters");
+    return false;
+  }
+  return true;
+}
+
+// overload protection: WebServer answers one client at a time, and a feed holds it for a whole feed, so a tab or a
+// script hammering it would starve everyone else. every request first takes tokens from the bucket of its client's
+// IP and from the bucket of the whole server, and a feed takes FEED_COST more right before it waits for the feeder;
+// when a bucket is empty the request gets a 429 (its client) or a 503 (the server) with Retry-After at once, before
+// any work or flash write. with one client at a time, the server bucket is what bounds the work in flight: in the
+// long run at most one feed per FEED_COST / SERVER_REFILL seconds, so the pages stay responsive between them.
+const uint32_t REQUEST_COST = 1; // tokens
+const uint32_t FEED_COST = 60;
+const uint32_t CLIENT_BURST = 4 * (REQUEST_COST + FEED_COST); // the meals of one auto feed slot of home.html in a row
+const uint32_t CLIENT_REFILL = 1;                            // tokens per second: then a feed per minute
+const uint32_t SERVER_BURST = 2 * CLIENT_BURST;
+const uint32_t SERVER_REFILL = 2;
+const int RATE_CLIENTS = 8;
+
+struct TokenBucket
+{
+  uint32_t millitokens;
+  uint32_t updated; // millis()
+};
+
+struct RateClient
+{
+  uint32_t ip; // 0: a free slot
+  TokenBucket bucket;
+};
+
+RateClient rate_clients[RATE_CLIENTS] = {};
+TokenBucket server_bucket = {SERVER_BURST * 1000, 0};
+unsigned long rejected_count = 0; // 429 and 503 answers since the boot
+
+// the tokens of `bucket` now (in thousandths), refilled at `rate` tokens per second up to `burst`
+uint32_t refill(TokenBucket &bucket, uint32_t burst, uint32_t rate)
+{
+  uint32_t now = millis();
+  uint64_t millitokens = bucket.millitokens + (uint64_t)(uint32_t)(now - bucket.updated) * rate;
+  bucket.millitokens = millitokens < burst * 1000 ? millitokens : burst * 1000;
+  bucket.updated = now;
+  return bucket.millitokens;
+}
+
+// seconds until `bucket` holds `tokens`
+uint32_t seconds_until(const TokenBucket &bucket, uint32_t tokens, uint32_t rate)
+{
+  uint32_t missing = tokens * 1000 > bucket.millitokens ? tokens * 1000 - bucket.millitokens : 0;
+  return (missing + rate * 1000 - 1) / (rate * 1000);
+}
+
+// the bucket of `ip`; a new client takes a free slot or the one of a client that has been quiet long enough to be
+// full again (forgetting it changes nothing). NULL when every slot is in use by a client that is still limited.
+RateClient *rate_client(uint32_t ip)
+{
+  RateClient *reusable = NULL;
+  for (int i = 0; i < RATE_CLIENTS; i++)
+  {
+    RateClient &client = rate_clients[i];
+    if (client.ip == ip)
+    {
+      return &client;
+    }
+    if (reusable == NULL && (client.ip == 0 || refill(client.bucket, CLIENT_BURST, CLIENT_REFILL) == CLIENT_BURST * 1000))
+    {
+      reusable = &client;
+    }
+  }
+  if (reusable != NULL)
+  {
+    reusable->ip = ip;
+    reusable->bucket = {CLIENT_BURST * 1000, (uint32_t)millis()};
+  }
+  return reusable;
+}
+
+void reject(int code, uint32_t retry_after, const char *message)
+{
+  rejected_count += 1;
+  server.sendHeader("Retry-After", String(retry_after > 0 ? retry_after : 1));
+  server.send(code, "text/plain", message);
+}
+
+// takes `cost` tokens for the request being handled; false (answered with 429 or 503) if it has to wait
+bool admit(uint32_t cost)
+{
+  IPAddress address = server.client().remoteIP();
+  uint32_t ip = (uint32_t)address[0] << 24 | (uint32_t)address[1] << 16 | (uint32_t)address[2] << 8 | address[3];
+  RateClient *client = rate_client(ip);
+  if (client == NULL)
+  {
+    uint32_t retry_after = CLIENT_BURST / CLIENT_REFILL;
+    for (int i = 0; i < RATE_CLIENTS; i++)
+    {
+      uint32_t seconds = seconds_until(rate_clients[i].bucket, CLIENT_BURST, CLIENT_REFILL);
+      retry_after = seconds < retry_after ? seconds : retry_after;
+    }
+    reject(503, retry_after, "too many clients");
+    return false;
+  }
+  if (refill(client->bucket, CLIENT_BURST, CLIENT_REFILL) < cost * 1000)
+  {
+    reject(429, seconds_until(client->bucket, cost, CLIENT_REFILL), "too many requests");
+    return false;
+  }
+  if (refill(server_bucket, SERVER_BURST, SERVER_REFILL) < cost * 1000)
+  {
+    reject(503, seconds_until(server_bucket, cost, SERVER_REFILL), "busy");
+    return false;
+  }
+  client->bucket.millitokens -= cost * 1000;
+  server_bucket.millitokens -= cost * 1000;
+  return true;
+}
+
+// manual presses: while a line is in INPUT mode, the feeder's button pulls it LOW like we do.
+// every edge (re)starts a one-shot hardware timer, and the line is only read once it has been quiet for
+// config.debounce_duration, so contact bounce never counts twice and nothing is polled in loop().
+hw_timer_t *debounce_timer = NULL;
+volatile bool debounce_running = false;
+
+struct ButtonLine
+{
+  int pin;
+  volatile bool driving;    // we are pressing it ourselves: its edges are not manual presses
+  volatile bool pending;    // an edge happened since the last debounce
+  volatile bool is_pressed; // the last debounced level was LOW
+  volatile unsigned long *count;
+  volatile unsigned long *manual_count;
+  EventType event;
+};
+
+ButtonLine meal_line = {MEAL_PIN, false, false, false, &meal_count, &manual_meal_count, EVENT_MANUAL_MEAL};
+ButtonLine snack_line = {SNACK_PIN, false, false, false, &snack_count, &manual_snack_count, EVENT_MANUAL_SNACK};
+
+void IRAM_ATTR on_button_edge(void *arg)
+{
+  ButtonLine *line = (ButtonLine *)arg;
+  if (line->driving)
+  {
+    return;
+  }
+  line->pending = true;
+  timerRestart(debounce_timer); // back to 0: the window starts again at every bounce
+  if (!debounce_running)
+  {
+    debounce_running = true;
+    timerStart(debounce_timer);
+  }
+}
+
+void IRAM_ATTR debounce_line(ButtonLine &line)
+{
+  if (!line.pending || line.driving)
+  {
+    return;
+  }
+  line.pending = false;
+  bool is_pressed = digitalRead(line.pin) == LOW;
+  if (is_pressed && !line.is_pressed)
+  {
+    // counted on the debounced press, the release only re-arms it
+    portENTER_CRITICAL_ISR(&event_mux);
+    *line.count += 1;
+    *line.manual_count += 1;
+    log_event_locked(line.event);
+    portEXIT_CRITICAL_ISR(&event_mux);
+    counts_dirty = true;
+  }
+  line.is_pressed = is_pressed;
+}
+
+void IRAM_ATTR on_debounce_timer()
+{
+  timerStop(debounce_timer);
+  debounce_running = false;
+  debounce_line(meal_line);
+  debounce_line(snack_line);
+}
+
+void setup_button_interrupts()
+{
+  debounce_timer = timerBegin(1000000); // 1MHz: 1 tick per us
+  timerAttachInterrupt(debounce_timer, &on_debounce_timer);
+  // auto-reloaded (a one-shot alarm disarms itself), and stopped by the interrupt after each firing
+  timerAlarm(debounce_timer, config.debounce_duration * 1000, true, 0);
+  timerStop(debounce_timer);
+  meal_line.pin = config.meal_pin;
+  snack_line.pin = config.snack_pin;
+  pinMode(meal_line.pin, INPUT);
+  pinMode(snack_line.pin, INPUT);
+  attachInterruptArg(digitalPinToInterrupt(meal_line.pin), on_button_edge, &meal_line, CHANGE);
+  attachInterruptArg(digitalPinToInterrupt(snack_line.pin), on_button_edge, &snack_line, CHANGE);
+}
+
 void root()
 {
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
   digitalWrite(LED_PIN, HIGH);
+  if (counts_dirty)
+  {
+    save_counts(); // what a client has seen is never lost
+  }
   String message = "";
   message += "<h3>meal count: " + String(meal_count) + "</h3>";
   message += "<h3>snack count: " + String(snack_count) + "</h3>";
+  message += "<h3>manual meal count: " + String(manual_meal_count) + "</h3>";
+  message += "<h3>manual snack count: " + String(manual_snack_count) + "</h3>";
+  message += "<h3>rejected request count: " + String(rejected_count) + "</h3>";
   message += "Click <a href=\"/on\">/on</a> to turn the LED on.<br>";
   message += "Click <a href=\"/off\">/off</a> to turn the LED off.<br>";
   message += "Click <a href=\"/meal\">/meal</a> to feed meal.<br>";
   message += "Click <a href=\"/snack\">/snack</a> to feed snack.<br>";
+  message += "Click <a href=\"/events\">/events</a> to list the last feeds.<br>";
   server.send(200, "text/html", message);
   digitalWrite(LED_PIN, LOW);
 }
 
 void on()
 {
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
   Serial.println("request: /on");
@@ -45,61 +422,315 @@ void on()
 
 void off()
 {
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
   digitalWrite(LED_PIN, HIGH);
   Serial.println("request: /off");
   server.send(200, "text/html", "LED off");
 }
 
+// heartbeat: a small JSON datagram to a multicast group every HEARTBEAT_INTERVAL, so that the hosts learn which boards
+// are there, their address and their counters without polling them (see fleet.py). it also goes out while a feed
+// waits for the feeder, so a feed is not mistaken for an outage.
+const IPAddress HEARTBEAT_GROUP(239, 255, 42, 1);
+const uint16_t HEARTBEAT_PORT = 42100;
+const uint32_t HEARTBEAT_INTERVAL = 5000; // ms
+
+WiFiUDP heartbeat_udp;
+uint32_t previous_heartbeat = 0;
+uint32_t heartbeat_sequence = 0; // from 0 at every boot: a gap is a lost packet, a restart is a reboot
+uint64_t uptime_ms = 0;          // 64 bits, unlike millis()
+uint32_t uptime_updated = 0;
+volatile uint8_t feeds_pending = 0; // the feed requests in the handlers: 0 or 1, one client at a time
+
+void send_heartbeat()
+{
+  uint32_t now = millis();
+  uptime_ms += (uint32_t)(now - uptime_updated);
+  uptime_updated = now;
+  if ((uint32_t)(now - previous_heartbeat) < HEARTBEAT_INTERVAL || WiFi.status() != WL_CONNECTED)
+  {
+    return;
+  }
+  previous_heartbeat = now;
+  uint32_t since_feed = now - previous_feed;
+  uint32_t queue_ms = since_feed < config.feed_interval ? config.feed_interval - since_feed : 0;
+  String packet = "{\"id\":\"" + String(config.mdns_name) + "\"";
+  packet += ",\"ip\":\"" + WiFi.localIP().toString() + "\"";
+  packet += ",\"version\":" + String(FIRMWARE_VERSION);
+  packet += ",\"sequence\":" + String(heartbeat_sequence);
+  packet += ",\"uptime\":" + String((unsigned long)(uptime_ms / 1000));
+  packet += ",\"meal_count\":" + String(meal_count);
+  packet += ",\"snack_count\":" + String(snack_count);
+  packet += ",\"manual_meal_count\":" + String(manual_meal_count);
+  packet += ",\"manual_snack_count\":" + String(manual_snack_count);
+  packet += ",\"rejected_request_count\":" + String(rejected_count);
+  packet += ",\"queue\":" + String(feeds_pending);
+  packet += ",\"queue_ms\":" + String(queue_ms) + "}";
+  heartbeat_sequence += 1;
+  heartbeat_udp.beginPacket(HEARTBEAT_GROUP, HEARTBEAT_PORT);
+  heartbeat_udp.write((const uint8_t *)packet.c_str(), packet.length());
+  heartbeat_udp.endPacket();
+}
+
 void wait_to_feed()
 {
-  while (millis() - previous_feed < feed_interval)
+  while ((uint32_t)(millis() - previous_feed) < config.feed_interval)
   {
+    send_heartbeat();
     delay(100);
   }
   previous_feed = millis();
 }
 
-void press_button(int PIN, bool pressed)
+void press_button(ButtonLine &line, bool pressed)
 {
   if (pressed)
   {
-    digitalWrite(PIN, LOW);
+    line.driving = true;
+    digitalWrite(line.pin, LOW);
     delay(10); // make sure that in the output mode, the value is always LOW
-    pinMode(PIN, OUTPUT);
+    pinMode(line.pin, OUTPUT);
   }
   else
   {
-    pinMode(PIN, INPUT);
+    pinMode(line.pin, INPUT);
+    delay(config.debounce_duration); // let the line settle before listening to it again
+    line.pending = false;
+    line.is_pressed = digitalRead(line.pin) == LOW;
+    line.driving = false;
   }
 }
 
 void feed_meal()
 {
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
   Serial.println("request: /meal");
+  String id;
+  if (!parse_id(id))
+  {
+    return;
+  }
+  if (is_recent_id(id))
+  {
+    server.send(200, "text/plain", "meal count: " + String(meal_count));
+    return;
+  }
+  if (!admit(FEED_COST))
+  {
+    return;
+  }
+  feeds_pending += 1;
   wait_to_feed();
-  press_button(MEAL_PIN, true);
-  delay(press_duration);
-  press_button(MEAL_PIN, false);
-  meal_count += 1;
+  remember_id(id);
+  press_button(meal_line, true);
+  delay(config.press_duration);
+  press_button(meal_line, false);
+  count_feed(meal_count, EVENT_MEAL);
+  feeds_pending -= 1;
   server.send(200, "text/plain", "meal count: " + String(meal_count));
 }
 
 void feed_snack()
 {
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
   Serial.println("request: /snack");
+  String id;
+  if (!parse_id(id))
+  {
+    return;
+  }
+  if (is_recent_id(id))
+  {
+    server.send(200, "text/plain", "snack count: " + String(snack_count));
+    return;
+  }
+  if (!admit(FEED_COST))
+  {
+    return;
+  }
+  feeds_pending += 1;
   wait_to_feed();
-  press_button(SNACK_PIN, true);
-  delay(press_duration);
-  press_button(SNACK_PIN, false);
-  snack_count += 1;
+  remember_id(id);
+  press_button(snack_line, true);
+  delay(config.press_duration);
+  press_button(snack_line, false);
+  count_feed(snack_count, EVENT_SNACK);
+  feeds_pending -= 1;
   server.send(200, "text/plain", "snack count: " + String(snack_count));
 }
 
+void list_events()
+{
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
+  // copied under the lock, formatted outside of it
+  LogEvent events[EVENT_LOG_SIZE];
+  portENTER_CRITICAL(&event_mux);
+  unsigned long count = event_count;
+  memcpy(events, event_log, sizeof(event_log));
+  portEXIT_CRITICAL(&event_mux);
+
+  unsigned long first = count > EVENT_LOG_SIZE ? count - EVENT_LOG_SIZE : 0;
+  String message = "now: " + String(millis()) + "\n";
+  for (unsigned long i = first; i < count; i++)
+  {
+    LogEvent &event = events[i % EVENT_LOG_SIZE];
+    message += String(event.at) + " " + event_names[event.type] + "\n";
+  }
+  server.send(200, "text/plain", message);
+}
+
+String config_text()
+{
+  String message = "";
+  message += "version=" + String(config.version) + "\n";
+  message += "feed_interval=" + String(config.feed_interval) + "\n";
+  message += "press_duration=" + String(config.press_duration) + "\n";
+  message += "debounce_duration=" + String(config.debounce_duration) + "\n";
+  message += "meal_pin=" + String(config.meal_pin) + "\n";
+  message += "snack_pin=" + String(config.snack_pin) + "\n";
+  message += "mdns_name=" + String(config.mdns_name) + "\n";
+  return message;
+}
+
+// parses argument `name` into `value` if present; false (with `error` set) if it is present but not a plain number
+// (digits only: toInt() would read "12abc" as 12) or out of range
+bool parse_number(const char *name, long min_value, long max_value, uint32_t &value, String &error)
+{
+  if (!server.hasArg(name))
+  {
+    return true;
+  }
+  String text = server.arg(name);
+  bool digits = text.length() > 0 && text.length() <= 9; // no overflow of long
+  for (unsigned int i = 0; digits && i < text.length(); i++)
+  {
+    digits = text[i] >= '0' && text[i] <= '9';
+  }
+  long parsed = digits ? text.toInt() : 0;
+  if (!digits || parsed < min_value || parsed > max_value)
+  {
+    error = String(name) + " must be between " + String(min_value) + " and " + String(max_value);
+    return false;
+  }
+  value = parsed;
+  return true;
+}
+
+bool is_button_pin(uint32_t pin)
+{
+  // GPIO2-10 of the ESP32-C3 minus the LED: not the 32 kHz crystal (0, 1), the flash (11-17) or USB/UART (18-21).
+  // 2, 8 and 9 are strapping pins, and the defaults are 8 and 9: they are fine for these lines because we only
+  // ever pull them LOW during a press and the feeder holds them HIGH otherwise, which is the level for a normal
+  // boot; only a button held down through a reset would start the bootloader instead.
+  return pin >= 2 && pin <= 10 && pin != (uint32_t)LED_PIN;
+}
+
+// GET /config: the current config as `key=value` lines
+// GET or POST /config?feed_interval=9000&...: validates all the given fields, then applies and saves them at once.
+// the timings and the mDNS name apply immediately (no feed is in progress while a handler runs); the pins apply
+// after a restart, since the lines would otherwise change under an attached interrupt.
+void handle_config()
+{
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
+  uint32_t new_feed_interval = config.feed_interval;
+  uint32_t new_press_duration = config.press_duration;
+  uint32_t new_debounce_duration = config.debounce_duration;
+  uint32_t new_meal_pin = config.meal_pin;
+  uint32_t new_snack_pin = config.snack_pin;
+  String error = "";
+  if (!parse_number("feed_interval", 1000, 600000, new_feed_interval, error) ||
+      !parse_number("press_duration", 100, 10000, new_press_duration, error) ||
+      !parse_number("debounce_duration", 5, 500, new_debounce_duration, error) ||
+      !parse_number("meal_pin", 0, 255, new_meal_pin, error) ||
+      !parse_number("snack_pin", 0, 255, new_snack_pin, error))
+  {
+    server.send(400, "text/plain", error);
+    return;
+  }
+  if (new_press_duration + 1000 > new_feed_interval)
+  {
+    server.send(400, "text/plain", "feed_interval must be at least press_duration + 1000");
+    return;
+  }
+  if (!is_button_pin(new_meal_pin) || !is_button_pin(new_snack_pin) || new_meal_pin == new_snack_pin)
+  {
+    server.send(400, "text/plain", "meal_pin and snack_pin must be different GPIOs between 2 and 10, not the LED");
+    return;
+  }
+  String new_mdns_name = server.hasArg("mdns_name") ? server.arg("mdns_name") : String(config.mdns_name);
+  if (new_mdns_name.length() == 0 || new_mdns_name.length() >= sizeof(config.mdns_name))
+  {
+    server.send(400, "text/plain", "mdns_name must have 1 to 31 characters");
+    return;
+  }
+  for (unsigned int i = 0; i < new_mdns_name.length(); i++)
+  {
+    char c = new_mdns_name[i];
+    if (!isalnum(c) && c != '-' && c != '_')
+    {
+      server.send(400, "text/plain", "mdns_name may only contain letters, digits, '-' and '_'");
+      return;
+    }
+  }
+
+  bool debounce_changed = new_debounce_duration != config.debounce_duration;
+  bool mdns_changed = new_mdns_name != config.mdns_name;
+  bool restart_required = new_meal_pin != (uint32_t)meal_line.pin || new_snack_pin != (uint32_t)snack_line.pin;
+  config.feed_interval = new_feed_interval;
+  config.press_duration = new_press_duration;
+  config.debounce_duration = new_debounce_duration;
+  config.meal_pin = new_meal_pin;
+  config.snack_pin = new_snack_pin;
+  strncpy(config.mdns_name, new_mdns_name.c_str(), sizeof(config.mdns_name) - 1);
+  config.mdns_name[sizeof(config.mdns_name) - 1] = '\0';
+
+  if (debounce_changed)
+  {
+    timerAlarm(debounce_timer, config.debounce_duration * 1000, true, 0);
+  }
+  if (mdns_changed)
+  {
+    MDNS.end();
+    MDNS.begin(config.mdns_name);
+  }
+  if (!save_config())
+  {
+    server.send(500, "text/plain", "applied but failed to save to NVS\n" + config_text());
+    return;
+  }
+  String message = config_text();
+  if (restart_required)
+  {
+    message += "the pins apply after a restart\n";
+  }
+  Serial.println("request: /config");
+  server.send(200, "text/plain", message);
+}
+
 void handleNotFound()
 {
+  if (!admit(REQUEST_COST))
+  {
+    return;
+  }
   digitalWrite(LED_PIN, HIGH);
-  pinMode(MEAL_PIN, INPUT);
-  pinMode(SNACK_PIN, INPUT);
+  pinMode(meal_line.pin, INPUT);
+  pinMode(snack_line.pin, INPUT);
   String message = "Not Found\n\n";
   message += "URI: ";
   message += server.uri();
@@ -119,7 +750,11 @@ void handleNotFound()
 void setup()
 {
   Serial.begin(115200);
+  uptime_updated = millis();
   pinMode(LED_PIN, OUTPUT); // set the LED pin mode
+  load_config();
+  load_counts();
+  load_recent_ids();
 
   delay(10);
 
@@ -144,7 +779,7 @@ void setup()
   Serial.println("IP address: ");
   Serial.println(WiFi.localIP());
 
-  if (MDNS.begin("dry_feeder"))
+  if (MDNS.begin(config.mdns_name))
   {
     Serial.println("MDNS responder started");
   }
@@ -156,15 +791,24 @@ void setup()
 
   server.on("/meal", feed_meal);
   server.on("/snack", feed_snack);
+  server.on("/events", list_events);
+  server.on("/config", handle_config);
 
   server.onNotFound(handleNotFound);
 
+  setup_button_interrupts();
+
   server.begin();
   Serial.println("HTTP server started");
 }
 
 void loop()
 {
+  if (counts_dirty)
+  {
+    save_counts();
+  }
+  send_heartbeat();
   server.handleClient();
   delay(2); // allow the cpu to switch to other tasks
 }
@@ -0,0 +1,138 @@
+// the part of the Arduino-ESP32 API that dry_feeder.ino uses, implemented by the soak simulator (soak.cpp)
+// on a virtual clock: delay() advances the simulated time and runs the interrupts and faults that fall in it
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define IRAM_ATTR
+#define LED_BUILTIN 21
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 1
+#define OUTPUT 3
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+
+// thrown out of delay() when the simulator cuts the power; caught by the simulator, never by the firmware
+struct SimBrownout
+{
+};
+
+// the simulator runs one thing at a time: interrupts only happen inside delay() and handleClient()
+typedef struct
+{
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+inline void portENTER_CRITICAL(portMUX_TYPE *) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE *) {}
+inline void portENTER_CRITICAL_ISR(portMUX_TYPE *) {}
+inline void portEXIT_CRITICAL_ISR(portMUX_TYPE *) {}
+
+unsigned long millis();
+void delay(unsigned long ms);
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+inline int digitalPinToInterrupt(int pin) { return pin; }
+void attachInterruptArg(int pin, void (*handler)(void *), void *arg, int mode);
+
+struct hw_timer_t;
+hw_timer_t *timerBegin(uint32_t frequency);
+void timerAttachInterrupt(hw_timer_t *timer, void (*handler)());
+void timerAlarm(hw_timer_t *timer, uint64_t alarm_value, bool autoreload, uint64_t reload_count);
+void timerStart(hw_timer_t *timer);
+void timerStop(hw_timer_t *timer);
+void timerRestart(hw_timer_t *timer);
+
+class String
+{
+public:
+  String(const char *text = "") : value(text) {}
+  String(const std::string &text) : value(text) {}
+  String(char c) : value(1, c) {}
+  String(int number) : value(std::to_string(number)) {}
+  String(unsigned int number) : value(std::to_string(number)) {}
+  String(long number) : value(std::to_string(number)) {}
+  String(unsigned long number) : value(std::to_string(number)) {}
+  String(double number, unsigned int decimals = 2)
+  {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, number);
+    value = buffer;
+  }
+
+  String operator+(const String &other) const { return String(value + other.value); }
+  friend String operator+(const char *left, const String &right) { return String(left + right.value); }
+  String &operator+=(const String &other)
+  {
+    value += other.value;
+    return *this;
+  }
+  bool operator==(const String &other) const { return value == other.value; }
+  bool operator!=(const String &other) const { return value != other.value; }
+  char operator[](unsigned int index) const { return index < value.size() ? value[index] : 0; }
+
+  unsigned int length() const { return value.size(); }
+  const char *c_str() const { return value.c_str(); }
+  long toInt() const { return strtol(value.c_str(), NULL, 10); }
+  float toFloat() const { return strtof(value.c_str(), NULL); }
+  int indexOf(const String &text, unsigned int from = 0) const
+  {
+    size_t found = value.find(text.value, from);
+    return found == std::string::npos ? -1 : (int)found;
+  }
+  String substring(unsigned int from, unsigned int to = (unsigned int)-1) const
+  {
+    from = from < value.size() ? from : value.size();
+    return String(value.substr(from, to < from ? 0 : to - from));
+  }
+  bool startsWith(const String &prefix) const { return value.compare(0, prefix.value.size(), prefix.value) == 0; }
+
+private:
+  std::string value;
+};
+
+class IPAddress
+{
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : bytes{a, b, c, d} {}
+  uint8_t operator[](int index) const { return bytes[index]; }
+  String toString() const
+  {
+    return String(bytes[0]) + "." + String(bytes[1]) + "." + String(bytes[2]) + "." + String(bytes[3]);
+  }
+  bool operator==(const IPAddress &other) const { return memcmp(bytes, other.bytes, 4) == 0; }
+
+private:
+  uint8_t bytes[4];
+};
+
+// the console of the firmware, printed by the simulator with --verbose
+void sim_print(const std::string &text);
+
+struct HardwareSerial
+{
+  void begin(unsigned long) {}
+  void print(const String &text) { sim_print(text.c_str()); }
+  void print(const char *text) { sim_print(text); }
+  void print(const IPAddress &address) { sim_print(address.toString().c_str()); }
+  template <typename T>
+  void print(T value) { sim_print(String(value).c_str()); }
+  template <typename T>
+  void println(T value)
+  {
+    print(value);
+    println();
+  }
+  void println() { sim_print("\n"); }
+};
+extern HardwareSerial Serial;
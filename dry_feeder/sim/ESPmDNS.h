@@ -0,0 +1,9 @@
+#pragma once
+#include "Arduino.h"
+
+struct MDNSResponder
+{
+  bool begin(const char *) { return true; }
+  void end() {}
+};
+extern MDNSResponder MDNS;
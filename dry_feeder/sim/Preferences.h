@@ -0,0 +1,19 @@
+#pragma once
+#include "Arduino.h"
+
+// NVS: kept by the simulator across brownouts; every put is atomic, as in ESP-IDF
+class Preferences
+{
+public:
+  bool begin(const char *name, bool read_only = false);
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buffer, size_t length);
+  size_t putBytes(const char *key, const void *value, size_t length);
+  unsigned long getULong(const char *key, unsigned long default_value = 0);
+  size_t putULong(const char *key, unsigned long value);
+  String getString(const char *key, const String &default_value = String());
+  size_t putString(const char *key, const String &value);
+
+private:
+  std::string name;
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include "Arduino.h"
+#include "WiFi.h"
+
+enum HTTPMethod
+{
+  HTTP_ANY,
+  HTTP_GET,
+  HTTP_POST,
+};
+
+// one server per board; the simulator owns the connections and the request being handled
+class WebServer
+{
+public:
+  WebServer(int port);
+  ~WebServer();
+  void on(const char *uri, void (*handler)());
+  void onNotFound(void (*handler)());
+  void begin();
+  void handleClient();
+  void sendHeader(const String &name, const String &value, bool first = false);
+  void send(int code, const char *content_type, const String &content);
+  String uri();
+  HTTPMethod method();
+  int args();
+  String argName(int index);
+  String arg(int index);
+  String arg(const char *name);
+  bool hasArg(const char *name);
+  WiFiClient client();
+};
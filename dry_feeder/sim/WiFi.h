@@ -0,0 +1,22 @@
+#pragma once
+#include "Arduino.h"
+
+#define WIFI_STA 1
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+// the connection of the request being handled, see `WebServer::client`
+class WiFiClient
+{
+public:
+  IPAddress remoteIP();
+};
+
+struct WiFiClass
+{
+  void mode(int) {}
+  void begin(const char *ssid, const char *password);
+  int status();
+  IPAddress localIP();
+};
+extern WiFiClass WiFi;
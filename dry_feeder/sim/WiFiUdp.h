@@ -0,0 +1,16 @@
+#pragma once
+#include "Arduino.h"
+
+#include <string>
+
+// outgoing datagrams only: the heartbeat, handed to the simulator at `endPacket`
+class WiFiUDP
+{
+public:
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(const uint8_t *buffer, size_t size);
+  int endPacket();
+
+private:
+  std::string packet;
+};
@@ -0,0 +1,6 @@
+// the sketch, unchanged, as a shared library: the simulator reloads it at every brownout so that all the globals
+// start from their initial values like after a real reset (see soak.cpp)
+#include "../dry_feeder.ino"
+
+extern "C" void sim_setup() { setup(); }
+extern "C" void sim_loop() { loop(); }
@@ -0,0 +1,3 @@
+// only used when dry_feeder/password.hpp does not exist, e.g. on a fresh checkout
+const char *ssid = "simulated";
+const char *password = "simulated";
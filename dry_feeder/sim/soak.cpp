@@ -0,0 +1,1235 @@
+// fault-injection soak test of dry_feeder.ino: the unchanged sketch runs against a virtual clock, a simulated
+// network and a model of the feeder, for months of simulated time per minute, while WiFi drops, brownouts, host
+// clock jumps, manual presses, clients that retry during the blocking feed handler and a second client hammering
+// the pages and feeds (see `--abuse-per-day`) are injected at random.
+//
+// checked invariants:
+// - no double dispense: a feed request (`id`) is never dispensed twice, and the board never presses outside of one
+// - pins never stuck LOW: a line is never driven LOW for longer than `--stuck-ms`
+// - counters monotonic: within a boot, and across boots for every count a client has seen
+// - heartbeats: to the multicast group, and never with a count below one a client has seen
+// the latency of the host's feeds is reported, overall and while the other client hammers the board.
+//
+// build and run, from dry_feeder/:
+//   mkdir -p sim/build
+//   g++ -std=gnu++17 -O2 -shared -fPIC -fno-gnu-unique -Isim -o sim/build/firmware.so sim/firmware.cpp
+//   g++ -std=gnu++17 -O2 -rdynamic -Isim -o sim/build/soak sim/soak.cpp -ldl
+//   sim/build/soak --days=180 --seed=1
+//
+// the firmware is a shared library so that a brownout can unload it and load it again: all its globals start
+// over as after a real reset, while NVS lives in the simulator.
+#include "Arduino.h"
+#include "ESPmDNS.h"
+#include "Preferences.h"
+#include "WebServer.h"
+#include "WiFi.h"
+#include "WiFiUdp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <dlfcn.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+MDNSResponder MDNS;
+
+namespace
+{
+
+const uint64_t MS = 1000; // the virtual time is in microseconds
+const uint64_t SECOND = 1000 * MS;
+const uint64_t HOUR = 3600 * SECOND;
+const uint64_t DAY = 24 * HOUR;
+
+// millis() starts 10 minutes before its 32-bit wrap at every boot, so that every boot crosses it
+const uint32_t MILLIS_AT_BOOT = UINT32_MAX - 10 * 60 * 1000;
+
+const int PINS = 22;
+const IPAddress HOST_IP(192, 168, 0, 91);   // the feeds with an id, as home.html sends them
+const IPAddress ABUSER_IP(192, 168, 0, 50); // a runaway tab or script
+
+const int MEAL_LINE = 9; // the defaults of the firmware config
+const int SNACK_LINE = 8;
+
+struct Options
+{
+  double days = 180;
+  uint64_t seed = 1;
+  std::string firmware = "sim/build/firmware.so";
+  bool verbose = false;
+  double requests_per_hour = 2;
+  double manual_presses_per_day = 4;
+  double wifi_drops_per_day = 2;
+  double brownouts_per_day = 0.5;
+  double clock_jumps_per_day = 0.2;
+  double press_brownouts = 0.02; // probability of a brownout during a press of the board
+  double request_drops = 0.05;   // probability of a WiFi drop while a request is handled
+  uint64_t stuck_ms = 5000;
+  double abuse_per_day = 1; // episodes of `abuse_minutes` at `abuse_per_second` requests, a fifth of them feeds
+  double abuse_minutes = 10;
+  double abuse_per_second = 10;
+};
+
+struct Stats
+{
+  uint64_t calls = 0;
+  uint64_t attempts = 0;
+  uint64_t refused = 0;
+  uint64_t timeouts = 0;
+  uint64_t answered = 0;
+  uint64_t failed = 0; // gave up after all the attempts
+  uint64_t dispensed = 0;
+  uint64_t manual_dispensed = 0;
+  uint64_t manual_presses = 0;
+  uint64_t brownouts = 0;
+  uint64_t brownouts_mid_press = 0;
+  uint64_t wifi_drops = 0;
+  uint64_t clock_jumps = 0;
+  uint64_t boots = 0;
+  uint64_t shed = 0; // attempts of the host answered 429 or 503
+  uint64_t abusive_requests = 0;
+  uint64_t abusive_refused = 0; // by the full backlog
+  uint64_t abusive_rejected = 0; // 429 or 503
+  uint64_t abusive_dispensed = 0;
+  uint64_t heartbeats = 0;
+  uint64_t longest_heartbeat_gap = 0;
+  std::vector<double> latencies; // s from the first attempt of a host call to its answer
+  std::vector<double> abuse_latencies; // of the calls made while the board was hammered
+};
+
+// a feed the host wants, with its idempotency id, tried up to `max_attempts` times
+struct Call
+{
+  uint64_t id;
+  std::string uri;
+  int attempts = 0;
+  bool answered = false;
+  int dispensed = 0;
+  bool abusive = false; // one attempt, without an id, never retried
+  uint64_t created = 0;
+  bool during_abuse = false;
+};
+
+// one TCP connection of one attempt; `open` until the client gives up or the board resets
+struct Connection
+{
+  std::shared_ptr<Call> call;
+  bool open = true;
+};
+
+struct Pin
+{
+  int mode = INPUT;
+  int out = HIGH;
+  bool held = false; // by a human on the feeder's own button
+  int level = HIGH;  // the feeder pulls the lines up
+  void (*isr)(void *) = nullptr;
+  void *arg = nullptr;
+  bool driven = false; // OUTPUT LOW by the board
+  uint64_t driven_since = 0;
+  uint64_t low_generation = 0;
+  uint64_t busy_until = 0; // of the feeder behind this line
+};
+
+struct Event
+{
+  uint64_t at;
+  uint64_t sequence;
+  std::function<void()> run;
+  bool operator>(const Event &other) const
+  {
+    return at != other.at ? at > other.at : sequence > other.sequence;
+  }
+};
+
+} // namespace
+
+struct hw_timer_t
+{
+  uint64_t boot;
+  uint32_t frequency;
+  void (*isr)() = nullptr;
+  uint64_t alarm_ticks = 0;
+  bool autoreload = false;
+  bool running = false;
+  uint64_t count = 0;      // ticks when last stopped or restarted
+  uint64_t started_at = 0; // virtual time of the last start or restart
+  uint64_t generation = 0; // invalidates the scheduled alarm
+};
+
+namespace
+{
+
+class World
+{
+public:
+  Options options;
+  Stats stats;
+  std::mt19937_64 random;
+  uint64_t now = 0;
+  uint64_t end = 0;
+  uint64_t sequence = 0;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::vector<std::string> violations;
+  uint64_t last_heartbeat = 0; // of this boot and WiFi connection, 0 before the first
+
+  // the board
+  bool powered = true;
+  uint64_t boot = 0; // incremented at every power cycle, invalidates the interrupts of the previous boot
+  uint64_t boot_at = 0;
+  Pin pins[PINS];
+  std::vector<std::unique_ptr<hw_timer_t>> timers;
+  std::map<std::string, std::vector<uint8_t>> nvs;
+  bool wifi_up = true;
+  uint64_t wifi_connected_at = 0;
+
+  // the web server
+  std::map<std::string, void (*)()> routes;
+  void (*not_found)() = nullptr;
+  bool listening = false;
+  std::deque<std::shared_ptr<Connection>> backlog;
+  std::shared_ptr<Connection> current;
+  std::map<std::string, std::string> current_args;
+  std::string current_uri;
+  std::map<std::string, std::string> current_headers; // of the answer
+
+  // the host
+  uint64_t next_call_id = 1;
+  uint64_t abuse_until = 0;
+  std::map<std::string, unsigned long> seen_counts; // the highest count answered to a client
+  std::map<std::string, unsigned long> last_counts; // of the running boot
+  std::map<std::string, volatile unsigned long *> counters;
+
+  double uniform(double low, double high) { return std::uniform_real_distribution<double>(low, high)(random); }
+  bool chance(double probability) { return uniform(0, 1) < probability; }
+  uint64_t exponential(double per_day)
+  {
+    return (uint64_t)(std::exponential_distribution<double>(per_day)(random) * DAY);
+  }
+
+  std::string timestamp() const
+  {
+    char text[64];
+    snprintf(text, sizeof(text), "day %.0f %02llu:%02llu:%06.3f", (double)(now / DAY),
+             (unsigned long long)(now % DAY / HOUR), (unsigned long long)(now % HOUR / (60 * SECOND)),
+             (double)(now % (60 * SECOND)) / SECOND);
+    return text;
+  }
+
+  void violation(const std::string &text)
+  {
+    if (violations.size() < 1000)
+    {
+      violations.push_back(timestamp() + ": " + text);
+    }
+  }
+
+  void at(uint64_t time, std::function<void()> run) { events.push({time, sequence++, std::move(run)}); }
+
+  // runs the events up to `time`; a brownout throws out of it
+  void run_until(uint64_t time)
+  {
+    while (!events.empty() && events.top().at <= time)
+    {
+      Event event = events.top();
+      events.pop();
+      now = event.at;
+      event.run();
+    }
+    now = time > now ? time : now;
+  }
+
+  // idle: jump to the next event
+  void run_next()
+  {
+    if (!events.empty())
+    {
+      run_until(events.top().at);
+    }
+  }
+
+  // pins and the feeder
+
+  void update_pin(int number)
+  {
+    Pin &pin = pins[number];
+    if (number != MEAL_LINE && number != SNACK_LINE)
+    {
+      return; // e.g. the LED: nothing behind it
+    }
+    bool driven = pin.mode == OUTPUT && pin.out == LOW;
+    if (driven && !pin.driven)
+    {
+      pin.driven_since = now;
+      uint64_t since = now;
+      uint64_t this_boot = boot;
+      at(now + options.stuck_ms * MS + 1, [this, number, since, this_boot]() {
+        if (boot == this_boot && pins[number].driven && pins[number].driven_since == since)
+        {
+          violation("pin " + std::to_string(number) + " stuck LOW for " + std::to_string(options.stuck_ms) + "ms");
+        }
+      });
+      if (chance(options.press_brownouts))
+      {
+        at(now + (uint64_t)uniform(0, 4.2 * SECOND), [this, this_boot]() {
+          if (boot == this_boot)
+          {
+            brownout();
+          }
+        });
+      }
+    }
+    pin.driven = driven;
+    int level = driven || pin.held ? LOW : HIGH;
+    if (level == pin.level)
+    {
+      return;
+    }
+    pin.level = level;
+    if (level == LOW)
+    {
+      // the feeder reacts to a press of 50ms when it is not busy dispensing
+      uint64_t generation = ++pin.low_generation;
+      at(now + 50 * MS, [this, number, generation]() {
+        Pin &pin = pins[number];
+        if (pin.level == LOW && pin.low_generation == generation && now >= pin.busy_until)
+        {
+          pin.busy_until = now + 8 * SECOND;
+          dispense(number);
+        }
+      });
+    }
+    else
+    {
+      pin.low_generation++;
+    }
+    if (pin.isr != nullptr && powered)
+    {
+      pin.isr(pin.arg);
+    }
+  }
+
+  void dispense(int number)
+  {
+    if (!pins[number].driven)
+    {
+      stats.manual_dispensed++;
+      return;
+    }
+    stats.dispensed++;
+    if (current == nullptr)
+    {
+      violation("pin " + std::to_string(number) + " pressed outside of a request");
+      return;
+    }
+    Call &call = *current->call;
+    call.dispensed++;
+    if (call.abusive)
+    {
+      stats.abusive_dispensed++;
+      return;
+    }
+    if (call.dispensed > 1)
+    {
+      violation("double dispense of request " + std::to_string(call.id) + " (" + call.uri + ")");
+    }
+  }
+
+  // a human presses the feeder's own button, with contact bounce on both edges
+  void manual_press()
+  {
+    int number = chance(0.8) ? MEAL_LINE : SNACK_LINE;
+    uint64_t duration = (uint64_t)uniform(80 * MS, 600 * MS);
+    const double press[] = {0, 0.8, 1.5, 2.7, 3.5};
+    const double release[] = {0, 0.6, 1.4};
+    for (int i = 0; i < 5; i++)
+    {
+      bool held = i % 2 == 0;
+      at(now + (uint64_t)(press[i] * MS), [this, number, held]() { set_held(number, held); });
+    }
+    for (int i = 0; i < 3; i++)
+    {
+      bool held = i % 2 == 1;
+      at(now + duration + (uint64_t)(release[i] * MS), [this, number, held]() { set_held(number, held); });
+    }
+    if (!pins[number].driven)
+    {
+      stats.manual_presses++;
+    }
+  }
+
+  void set_held(int number, bool held)
+  {
+    pins[number].held = held;
+    update_pin(number);
+  }
+
+  // timers
+
+  uint64_t ticks_of(hw_timer_t *timer) const
+  {
+    if (!timer->running)
+    {
+      return timer->count;
+    }
+    return timer->count + (now - timer->started_at) * timer->frequency / SECOND;
+  }
+
+  void schedule_alarm(hw_timer_t *timer)
+  {
+    uint64_t generation = ++timer->generation;
+    uint64_t ticks = ticks_of(timer);
+    uint64_t remaining = timer->alarm_ticks > ticks ? timer->alarm_ticks - ticks : 0;
+    uint64_t this_boot = boot;
+    at(now + remaining * SECOND / timer->frequency, [this, timer, generation, this_boot]() {
+      if (boot != this_boot || timer->generation != generation || !timer->running)
+      {
+        return;
+      }
+      if (timer->autoreload)
+      {
+        timer->count = 0;
+        timer->started_at = now;
+        schedule_alarm(timer);
+      }
+      if (timer->isr != nullptr)
+      {
+        timer->isr();
+      }
+    });
+  }
+
+  // network and host
+
+  void connect(std::shared_ptr<Call> call)
+  {
+    call->attempts++;
+    stats.attempts += call->abusive ? 0 : 1;
+    if (!powered || !listening || !wifi_up || now < wifi_connected_at || backlog.size() >= 5)
+    {
+      if (call->abusive)
+      {
+        stats.abusive_refused++;
+        return;
+      }
+      stats.refused++;
+      retry(call, 10 * SECOND);
+      return;
+    }
+    auto connection = std::make_shared<Connection>();
+    connection->call = call;
+    backlog.push_back(connection);
+    // the client waits 5 to 15s: often less than a feed that has to wait for the previous one
+    at(now + (uint64_t)uniform(5 * SECOND, 15 * SECOND), [this, connection]() {
+      if (!connection->open)
+      {
+        return;
+      }
+      connection->open = false;
+      stats.timeouts += connection->call->abusive ? 0 : 1;
+      retry(connection->call, 2 * SECOND);
+    });
+  }
+
+  void retry(std::shared_ptr<Call> call, uint64_t after)
+  {
+    if (call->answered || call->abusive)
+    {
+      return;
+    }
+    if (call->attempts >= 5)
+    {
+      stats.failed++;
+      return;
+    }
+    at(now + after, [this, call]() { connect(call); });
+  }
+
+  void new_call()
+  {
+    auto call = std::make_shared<Call>();
+    call->id = next_call_id++;
+    call->uri = chance(0.75) ? "/meal" : "/snack";
+    call->created = now;
+    call->during_abuse = now < abuse_until;
+    stats.calls++;
+    connect(call);
+  }
+
+  void new_abusive_call()
+  {
+    auto call = std::make_shared<Call>();
+    call->uri = chance(0.2) ? "/meal" : "/";
+    call->abusive = true;
+    stats.abusive_requests++;
+    connect(call);
+  }
+
+  void answer(int code, const std::string &content)
+  {
+    if (current == nullptr || !current->open || !wifi_up)
+    {
+      return; // the client is gone: the answer is lost
+    }
+    current->open = false;
+    Call &call = *current->call;
+    if (call.abusive)
+    {
+      stats.abusive_rejected += code == 429 || code == 503 ? 1 : 0;
+      return;
+    }
+    if (code == 429 || code == 503)
+    {
+      // shed before any work: the client comes back when told to
+      stats.shed++;
+      auto retry_after = current_headers.find("Retry-After");
+      if (retry_after == current_headers.end())
+      {
+        violation("request " + std::to_string(call.id) + " answered " + std::to_string(code) + " without Retry-After");
+        return;
+      }
+      retry(current->call, strtoull(retry_after->second.c_str(), NULL, 10) * SECOND);
+      return;
+    }
+    call.answered = true;
+    stats.answered++;
+    double latency = (double)(now - call.created) / SECOND;
+    (call.during_abuse ? stats.abuse_latencies : stats.latencies).push_back(latency);
+    if (code != 200)
+    {
+      violation("request " + std::to_string(call.id) + " answered " + std::to_string(code) + ": " + content);
+      return;
+    }
+    char kind[16];
+    unsigned long count;
+    if (sscanf(content.c_str(), "%15s count: %lu", kind, &count) != 2)
+    {
+      violation("unexpected answer: " + content);
+      return;
+    }
+    std::string name = std::string(kind) + "_count";
+    if (count < seen_counts[name])
+    {
+      violation(name + " answered " + std::to_string(count) + " after " + std::to_string(seen_counts[name]));
+    }
+    seen_counts[name] = std::max(seen_counts[name], count);
+  }
+
+  void heartbeat(const std::string &packet)
+  {
+    if (!wifi_up || now < wifi_connected_at)
+    {
+      return;
+    }
+    stats.heartbeats++;
+    if (last_heartbeat != 0)
+    {
+      stats.longest_heartbeat_gap = std::max(stats.longest_heartbeat_gap, now - last_heartbeat);
+    }
+    last_heartbeat = now;
+    at(now + 5 * SECOND + MS, []() {}); // wakes an idle board when the next one is due
+    for (auto &[name, seen] : seen_counts)
+    {
+      size_t at = packet.find("\"" + name + "\":");
+      if (at == std::string::npos)
+      {
+        violation("heartbeat without " + name + ": " + packet);
+        continue;
+      }
+      unsigned long count = strtoul(packet.c_str() + at + name.size() + 3, NULL, 10);
+      if (count < seen)
+      {
+        violation("heartbeat with " + name + " " + std::to_string(count) + " after a client saw " +
+                  std::to_string(seen));
+      }
+    }
+  }
+
+  // faults
+
+  // each kind of event reschedules itself with exponential inter-arrival times
+  void schedule_faults_of(const std::string &kind)
+  {
+    if (kind == "wake")
+    {
+      // an idle board jumps to the next event: the heartbeats wake it when the next one is due, and this in case
+      // they stopped (e.g. after a WiFi drop)
+      at(now + 60 * SECOND, [this]() { schedule_faults_of("wake"); });
+    }
+    else if (kind == "call")
+    {
+      at(now + exponential(options.requests_per_hour * 24), [this]() {
+        new_call();
+        schedule_faults_of("call");
+      });
+    }
+    else if (kind == "manual" && options.manual_presses_per_day > 0)
+    {
+      at(now + exponential(options.manual_presses_per_day), [this]() {
+        manual_press();
+        schedule_faults_of("manual");
+      });
+    }
+    else if (kind == "wifi" && options.wifi_drops_per_day > 0)
+    {
+      at(now + exponential(options.wifi_drops_per_day), [this]() {
+        drop_wifi();
+        schedule_faults_of("wifi");
+      });
+    }
+    else if (kind == "brownout" && options.brownouts_per_day > 0)
+    {
+      at(now + exponential(options.brownouts_per_day), [this]() {
+        schedule_faults_of("brownout");
+        brownout();
+      });
+    }
+    else if (kind == "abuse" && options.abuse_per_day > 0)
+    {
+      at(now + exponential(options.abuse_per_day), [this]() {
+        abuse_until = now + (uint64_t)(options.abuse_minutes * 60 * SECOND);
+        hammer();
+        schedule_faults_of("abuse");
+      });
+    }
+    else if (kind == "clock" && options.clock_jumps_per_day > 0)
+    {
+      // SNTP corrects the host clock and its feeding schedule catches up with a burst of new requests;
+      // the firmware itself only uses millis()
+      at(now + exponential(options.clock_jumps_per_day), [this]() {
+        stats.clock_jumps++;
+        int burst = 1 + (int)uniform(0, 3);
+        for (int i = 0; i < burst; i++)
+        {
+          new_call();
+        }
+        schedule_faults_of("clock");
+      });
+    }
+  }
+
+  void hammer()
+  {
+    if (now >= abuse_until)
+    {
+      return;
+    }
+    new_abusive_call();
+    at(now + (uint64_t)(SECOND / options.abuse_per_second), [this]() { hammer(); });
+  }
+
+  void drop_wifi()
+  {
+    if (!wifi_up)
+    {
+      return;
+    }
+    stats.wifi_drops++;
+    wifi_up = false;
+    last_heartbeat = 0;
+    // established connections break: their clients time out and retry
+    for (auto &connection : backlog)
+    {
+      connection->open = false;
+      retry(connection->call, 5 * SECOND);
+    }
+    backlog.clear();
+    at(now + (uint64_t)uniform(1 * SECOND, 120 * SECOND), [this]() {
+      wifi_up = true;
+      wifi_connected_at = now + (uint64_t)uniform(0.5 * SECOND, 3 * SECOND);
+    });
+  }
+
+  void brownout()
+  {
+    if (!powered)
+    {
+      return;
+    }
+    stats.brownouts++;
+    bool pressing = pins[MEAL_LINE].driven || pins[SNACK_LINE].driven;
+    if (pressing)
+    {
+      stats.brownouts_mid_press++;
+    }
+    powered = false;
+    throw SimBrownout();
+  }
+
+  // what the board does when it loses power: all the lines float back up and the connections reset
+  void power_off()
+  {
+    boot++;
+    listening = false;
+    routes.clear();
+    not_found = nullptr;
+    timers.clear();
+    for (int number = 0; number < PINS; number++)
+    {
+      Pin &pin = pins[number];
+      pin.mode = INPUT;
+      pin.out = HIGH;
+      pin.isr = nullptr;
+      update_pin(number);
+    }
+    for (auto &connection : backlog)
+    {
+      connection->open = false;
+      retry(connection->call, 5 * SECOND);
+    }
+    backlog.clear();
+    if (current != nullptr && current->open)
+    {
+      current->open = false;
+      retry(current->call, 5 * SECOND);
+    }
+    current = nullptr;
+  }
+
+  void power_on()
+  {
+    powered = true;
+    boot_at = now;
+    last_heartbeat = 0;
+    stats.boots++;
+    last_counts.clear();
+  }
+
+  // invariants of the counters, after every step of the firmware
+  void check_counters(bool after_boot)
+  {
+    for (auto &[name, counter] : counters)
+    {
+      unsigned long value = *counter;
+      auto last = last_counts.find(name);
+      if (last != last_counts.end() && value < last->second)
+      {
+        violation(name + " went from " + std::to_string(last->second) + " to " + std::to_string(value));
+      }
+      auto seen = seen_counts.find(name);
+      if (after_boot && seen != seen_counts.end() && value < seen->second)
+      {
+        violation(name + " restarted at " + std::to_string(value) + " after a client saw " +
+                  std::to_string(seen->second));
+      }
+      last_counts[name] = value;
+    }
+  }
+};
+
+World world;
+
+} // namespace
+
+// the Arduino API on the world
+
+void sim_print(const std::string &text)
+{
+  if (world.options.verbose)
+  {
+    fputs(text.c_str(), stdout);
+  }
+}
+
+unsigned long millis()
+{
+  return (uint32_t)(MILLIS_AT_BOOT + (world.now - world.boot_at) / MS);
+}
+
+void delay(unsigned long ms)
+{
+  world.run_until(world.now + ms * MS);
+}
+
+void pinMode(int pin, int mode)
+{
+  world.pins[pin].mode = mode;
+  world.update_pin(pin);
+}
+
+void digitalWrite(int pin, int value)
+{
+  world.pins[pin].out = value;
+  world.update_pin(pin);
+}
+
+int digitalRead(int pin)
+{
+  return world.pins[pin].level;
+}
+
+void attachInterruptArg(int pin, void (*handler)(void *), void *arg, int)
+{
+  world.pins[pin].isr = handler;
+  world.pins[pin].arg = arg;
+}
+
+hw_timer_t *timerBegin(uint32_t frequency)
+{
+  world.timers.push_back(std::make_unique<hw_timer_t>());
+  hw_timer_t *timer = world.timers.back().get();
+  timer->boot = world.boot;
+  timer->frequency = frequency;
+  timer->running = true; // like the ESP32 core, a new timer runs
+  timer->started_at = world.now;
+  return timer;
+}
+
+void timerAttachInterrupt(hw_timer_t *timer, void (*handler)())
+{
+  timer->isr = handler;
+}
+
+void timerAlarm(hw_timer_t *timer, uint64_t alarm_value, bool autoreload, uint64_t)
+{
+  timer->alarm_ticks = alarm_value;
+  timer->autoreload = autoreload;
+  if (timer->running)
+  {
+    world.schedule_alarm(timer);
+  }
+}
+
+void timerStart(hw_timer_t *timer)
+{
+  if (timer->running)
+  {
+    world.violation("timerStart on a running timer");
+    return;
+  }
+  timer->running = true;
+  timer->started_at = world.now;
+  world.schedule_alarm(timer);
+}
+
+void timerStop(hw_timer_t *timer)
+{
+  timer->count = world.ticks_of(timer);
+  timer->running = false;
+  timer->generation++;
+}
+
+void timerRestart(hw_timer_t *timer)
+{
+  timer->count = 0;
+  timer->started_at = world.now;
+  if (timer->running)
+  {
+    world.schedule_alarm(timer);
+  }
+}
+
+void WiFiClass::begin(const char *, const char *)
+{
+  world.wifi_connected_at = world.now + (uint64_t)world.uniform(1 * SECOND, 3 * SECOND);
+}
+
+int WiFiClass::status()
+{
+  return world.wifi_up && world.now >= world.wifi_connected_at ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+IPAddress WiFiClass::localIP()
+{
+  return IPAddress(192, 168, 0, 166);
+}
+
+WebServer::WebServer(int) {}
+WebServer::~WebServer() {}
+
+void WebServer::on(const char *uri, void (*handler)())
+{
+  world.routes[uri] = handler;
+}
+
+void WebServer::onNotFound(void (*handler)())
+{
+  world.not_found = handler;
+}
+
+void WebServer::begin()
+{
+  world.listening = true;
+}
+
+void WebServer::handleClient()
+{
+  if (world.backlog.empty())
+  {
+    world.run_next();
+  }
+  if (world.backlog.empty())
+  {
+    return;
+  }
+  world.current = world.backlog.front();
+  world.backlog.pop_front();
+  world.current_uri = world.current->call->uri;
+  world.current_args.clear();
+  if (!world.current->call->abusive)
+  {
+    world.current_args["id"] = std::to_string(world.current->call->id);
+  }
+  world.current_headers.clear();
+  if (!world.current->call->abusive && world.chance(world.options.request_drops))
+  {
+    uint64_t this_boot = world.boot;
+    world.at(world.now + (uint64_t)world.uniform(0, 12 * SECOND), [this_boot]() {
+      if (world.boot == this_boot)
+      {
+        world.drop_wifi();
+      }
+    });
+  }
+  auto route = world.routes.find(world.current_uri);
+  if (route != world.routes.end())
+  {
+    route->second();
+  }
+  else if (world.not_found != nullptr)
+  {
+    world.not_found();
+  }
+  world.current = nullptr;
+}
+
+void WebServer::sendHeader(const String &name, const String &value, bool)
+{
+  world.current_headers[name.c_str()] = value.c_str();
+}
+
+void WebServer::send(int code, const char *, const String &content)
+{
+  // writing the answer takes a few ms on the board, longer for a page
+  delay(5 + content.length() / 100);
+  world.answer(code, content.c_str());
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  if (!(ip == IPAddress(239, 255, 42, 1)) || port != 42100)
+  {
+    world.violation("datagram to " + std::string(ip.toString().c_str()) + ":" + std::to_string(port));
+  }
+  packet.clear();
+  return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+  packet.append((const char *)buffer, size);
+  return size;
+}
+
+int WiFiUDP::endPacket()
+{
+  world.heartbeat(packet);
+  return 1;
+}
+
+WiFiClient WebServer::client()
+{
+  return WiFiClient();
+}
+
+IPAddress WiFiClient::remoteIP()
+{
+  return world.current != nullptr && world.current->call->abusive ? ABUSER_IP : HOST_IP;
+}
+
+String WebServer::uri()
+{
+  return String(world.current_uri);
+}
+
+HTTPMethod WebServer::method()
+{
+  return HTTP_GET;
+}
+
+int WebServer::args()
+{
+  return world.current_args.size();
+}
+
+String WebServer::argName(int index)
+{
+  auto arg = world.current_args.begin();
+  std::advance(arg, index);
+  return String(arg->first);
+}
+
+String WebServer::arg(int index)
+{
+  auto arg = world.current_args.begin();
+  std::advance(arg, index);
+  return String(arg->second);
+}
+
+String WebServer::arg(const char *name)
+{
+  auto arg = world.current_args.find(name);
+  return arg == world.current_args.end() ? String() : String(arg->second);
+}
+
+bool WebServer::hasArg(const char *name)
+{
+  return world.current_args.count(name) > 0;
+}
+
+bool Preferences::begin(const char *namespace_name, bool)
+{
+  name = namespace_name;
+  return true;
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  auto value = world.nvs.find(name + "/" + key);
+  return value == world.nvs.end() ? 0 : value->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t length)
+{
+  auto value = world.nvs.find(name + "/" + key);
+  if (value == world.nvs.end() || value->second.size() > length)
+  {
+    return 0;
+  }
+  memcpy(buffer, value->second.data(), value->second.size());
+  return value->second.size();
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length)
+{
+  const uint8_t *bytes = (const uint8_t *)value;
+  world.nvs[name + "/" + key] = std::vector<uint8_t>(bytes, bytes + length);
+  return length;
+}
+
+unsigned long Preferences::getULong(const char *key, unsigned long default_value)
+{
+  uint32_t value; // 32 bits, as on the board
+  return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : default_value;
+}
+
+size_t Preferences::putULong(const char *key, unsigned long value)
+{
+  uint32_t stored = value;
+  return putBytes(key, &stored, sizeof(stored));
+}
+
+String Preferences::getString(const char *key, const String &default_value)
+{
+  auto value = world.nvs.find(name + "/" + key);
+  if (value == world.nvs.end())
+  {
+    return default_value;
+  }
+  return String(std::string(value->second.begin(), value->second.end()));
+}
+
+size_t Preferences::putString(const char *key, const String &value)
+{
+  return putBytes(key, value.c_str(), value.length());
+}
+
+namespace
+{
+
+struct Firmware
+{
+  void *handle = nullptr;
+  void (*setup)() = nullptr;
+  void (*loop)() = nullptr;
+
+  void load(const std::string &path)
+  {
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+      fprintf(stderr, "cannot load %s: %s\n", path.c_str(), dlerror());
+      exit(2);
+    }
+    setup = (void (*)())dlsym(handle, "sim_setup");
+    loop = (void (*)())dlsym(handle, "sim_loop");
+    auto *events = (volatile unsigned long *)dlsym(handle, "event_count");
+    if (setup == nullptr || loop == nullptr || events == nullptr || *events != 0)
+    {
+      fprintf(stderr, "%s is not a freshly loaded firmware\n", path.c_str());
+      exit(2);
+    }
+    world.counters.clear();
+    for (const char *name : {"meal_count", "snack_count", "manual_meal_count", "manual_snack_count"})
+    {
+      world.counters[name] = (volatile unsigned long *)dlsym(handle, name);
+    }
+  }
+
+  void unload()
+  {
+    world.counters.clear();
+    dlclose(handle);
+    handle = nullptr;
+  }
+};
+
+bool parse_option(const std::string &argument, const char *name, std::string &value)
+{
+  std::string prefix = std::string("--") + name + "=";
+  if (argument.compare(0, prefix.size(), prefix) != 0)
+  {
+    return false;
+  }
+  value = argument.substr(prefix.size());
+  return true;
+}
+
+std::string percentiles(std::vector<double> values)
+{
+  if (values.empty())
+  {
+    return "-";
+  }
+  std::sort(values.begin(), values.end());
+  char text[128];
+  snprintf(text, sizeof(text), "median %.1fs, p99 %.1fs, max %.1fs (%zu)", values[values.size() / 2],
+           values[values.size() * 99 / 100], values.back(), values.size());
+  return text;
+}
+
+Options parse_options(int argc, char **argv)
+{
+  Options options;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string argument = argv[i];
+    std::string value;
+    if (argument == "--verbose")
+      options.verbose = true;
+    else if (parse_option(argument, "days", value))
+      options.days = atof(value.c_str());
+    else if (parse_option(argument, "seed", value))
+      options.seed = strtoull(value.c_str(), NULL, 10);
+    else if (parse_option(argument, "firmware", value))
+      options.firmware = value;
+    else if (parse_option(argument, "requests-per-hour", value))
+      options.requests_per_hour = atof(value.c_str());
+    else if (parse_option(argument, "manual-presses-per-day", value))
+      options.manual_presses_per_day = atof(value.c_str());
+    else if (parse_option(argument, "wifi-drops-per-day", value))
+      options.wifi_drops_per_day = atof(value.c_str());
+    else if (parse_option(argument, "brownouts-per-day", value))
+      options.brownouts_per_day = atof(value.c_str());
+    else if (parse_option(argument, "clock-jumps-per-day", value))
+      options.clock_jumps_per_day = atof(value.c_str());
+    else if (parse_option(argument, "press-brownouts", value))
+      options.press_brownouts = atof(value.c_str());
+    else if (parse_option(argument, "request-drops", value))
+      options.request_drops = atof(value.c_str());
+    else if (parse_option(argument, "stuck-ms", value))
+      options.stuck_ms = strtoull(value.c_str(), NULL, 10);
+    else if (parse_option(argument, "abuse-per-day", value))
+      options.abuse_per_day = atof(value.c_str());
+    else if (parse_option(argument, "abuse-minutes", value))
+      options.abuse_minutes = atof(value.c_str());
+    else if (parse_option(argument, "abuse-per-second", value))
+      options.abuse_per_second = atof(value.c_str());
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", argument.c_str());
+      exit(2);
+    }
+  }
+  return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  world.options = parse_options(argc, argv);
+  world.random.seed(world.options.seed);
+  world.end = (uint64_t)(world.options.days * DAY);
+  auto started = std::chrono::steady_clock::now();
+
+  Firmware firmware;
+  firmware.load(world.options.firmware);
+  world.power_on();
+  world.schedule_faults_of("wake");
+  world.schedule_faults_of("call");
+  world.schedule_faults_of("manual");
+  world.schedule_faults_of("wifi");
+  world.schedule_faults_of("brownout");
+  world.schedule_faults_of("clock");
+  world.schedule_faults_of("abuse");
+
+  bool booted = false;
+  while (world.now < world.end)
+  {
+    try
+    {
+      if (!booted)
+      {
+        firmware.setup();
+        booted = true;
+        world.check_counters(true);
+      }
+      firmware.loop();
+      world.check_counters(false);
+    }
+    catch (const SimBrownout &)
+    {
+      world.power_off();
+      firmware.unload();
+      world.run_until(world.now + (uint64_t)world.uniform(0.5 * SECOND, 5 * SECOND));
+      firmware.load(world.options.firmware);
+      world.power_on();
+      booted = false;
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  const Stats &stats = world.stats;
+  printf("simulated %.0f days in %.1fs (seed %llu)\n", world.options.days, seconds,
+         (unsigned long long)world.options.seed);
+  printf("requests: %llu, attempts: %llu (refused %llu, timed out %llu), answered %llu, gave up %llu\n",
+         (unsigned long long)stats.calls, (unsigned long long)stats.attempts, (unsigned long long)stats.refused,
+         (unsigned long long)stats.timeouts, (unsigned long long)stats.answered, (unsigned long long)stats.failed);
+  printf("dispensed: %llu by the board, %llu by %llu manual presses\n", (unsigned long long)stats.dispensed,
+         (unsigned long long)stats.manual_dispensed, (unsigned long long)stats.manual_presses);
+  printf("faults: %llu brownouts (%llu mid-press), %llu WiFi drops, %llu clock jumps, %llu boots\n",
+         (unsigned long long)stats.brownouts, (unsigned long long)stats.brownouts_mid_press,
+         (unsigned long long)stats.wifi_drops, (unsigned long long)stats.clock_jumps,
+         (unsigned long long)stats.boots);
+  printf("abuse: %llu requests (%llu refused by the full backlog, %llu answered 429/503), %llu dispensed\n",
+         (unsigned long long)stats.abusive_requests, (unsigned long long)stats.abusive_refused,
+         (unsigned long long)stats.abusive_rejected, (unsigned long long)stats.abusive_dispensed);
+  printf("heartbeats: %llu, longest gap %.1fs\n", (unsigned long long)stats.heartbeats,
+         (double)stats.longest_heartbeat_gap / SECOND);
+  printf("host feeds answered in: %s; while hammered: %s; attempts shed: %llu\n",
+         percentiles(world.stats.latencies).c_str(), percentiles(world.stats.abuse_latencies).c_str(),
+         (unsigned long long)stats.shed);
+  for (auto &[name, counter] : world.counters)
+  {
+    printf("%s: %lu\n", name.c_str(), (unsigned long)*counter);
+  }
+  if (!world.violations.empty())
+  {
+    printf("%zu invariant violations:\n", world.violations.size());
+    for (size_t i = 0; i < world.violations.size() && i < 20; i++)
+    {
+      printf("  %s\n", world.violations[i].c_str());
+    }
+    return 1;
+  }
+  printf("all invariants held\n");
+  return 0;
+}
@@ -0,0 +1,240 @@
+import pathlib
+import os
+import sys
+import sqlite3
+from dataclasses import dataclass
+from threading import Lock
+import logging
+from logging import getLogger
+from datetime import datetime
+import arguably
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+
+TIME_FORMAT = "%Y-%m-%d_%H-%M-%S"  # the same format as `MotionDetector.now_mp4`
+
+
+def main():
+    index = EventIndex()
+
+    @arguably.command
+    def recent(*, count: int = 20):
+        for event in index.recent(count):
+            print(event)
+
+    @arguably.command
+    def pin(event_id: int):
+        """
+        keep the recordings of this event when the retention engine frees space
+        """
+        index.pin(event_id, True)
+
+    @arguably.command
+    def unpin(event_id: int):
+        index.pin(event_id, False)
+
+    arguably.run()
+
+
+def recording_start(filepath: pathlib.Path, prefix: str) -> datetime | None:
+    name = filepath.name
+    if not name.startswith(prefix) or not name.endswith(".mp4"):
+        return None
+    try:
+        return datetime.strptime(name[len(prefix) : -len(".mp4")], TIME_FORMAT)
+    except ValueError:
+        return None
+
+
+@dataclass
+class Event:
+    id: int
+    kind: str  # e.g. "motion"
+    start: datetime
+    end: datetime | None = None
+    file: str | None = None  # recording that covers the event, if any
+    pinned: bool = False  # never deleted by the retention engine
+
+
+class EventIndex:
+    """
+    machine-readable index of what happened in front of the camera, stored as a small sqlite database next to the
+    recordings so that other tools (clip export, retention, dashboards) can refer to an event by its id
+    """
+
+    def __init__(self, path: pathlib.Path = this_dir / "recordings" / "events.sqlite"):
+        path.parent.mkdir(parents=True, exist_ok=True)
+        # the detector thread writes while the asyncio loop and CLI tools read
+        self.lock = Lock()
+        self.connection = sqlite3.connect(str(path), check_same_thread=False)
+        with self.lock, self.connection:
+            self.connection.execute(
+                "CREATE TABLE IF NOT EXISTS events ("
+                "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "kind TEXT NOT NULL, "
+                "start REAL NOT NULL, "
+                "end REAL, "
+                "file TEXT, "
+                "pinned INTEGER NOT NULL DEFAULT 0)"
+            )
+            columns = [
+                row[1] for row in self.connection.execute("PRAGMA table_info(events)")
+            ]
+            if "pinned" not in columns:  # created before pinning existed
+                self.connection.execute(
+                    "ALTER TABLE events ADD COLUMN pinned INTEGER NOT NULL DEFAULT 0"
+                )
+            self.connection.execute(
+                "CREATE INDEX IF NOT EXISTS events_start ON events (start)"
+            )
+            # recordings that have been scanned by the backfill (see `backfill.py`)
+            self.connection.execute(
+                "CREATE TABLE IF NOT EXISTS indexed_files (file TEXT PRIMARY KEY)"
+            )
+
+    def close(self) -> None:
+        with self.lock:
+            self.connection.close()
+
+    def start(
+        self, kind: str, start: datetime | None = None, file: str | None = None
+    ) -> int:
+        start = start or datetime.now()
+        with self.lock, self.connection:
+            cursor = self.connection.execute(
+                "INSERT INTO events (kind, start, file) VALUES (?, ?, ?)",
+                (kind, start.timestamp(), file),
+            )
+        event_id = cursor.lastrowid
+        assert event_id is not None
+        _LOGGER.debug(f"Event {event_id} ({kind}) started at {start}")
+        return event_id
+
+    def end(self, event_id: int, end: datetime | None = None) -> None:
+        end = end or datetime.now()
+        with self.lock, self.connection:
+            self.connection.execute(
+                "UPDATE events SET end = ? WHERE id = ?", (end.timestamp(), event_id)
+            )
+
+    def open_events(self, kind: str) -> list[Event]:
+        """events of `kind` without an end: in progress, or left open by a detector that was killed"""
+        with self.lock:
+            rows = self.connection.execute(
+                "SELECT id, kind, start, end, file, pinned FROM events "
+                "WHERE kind = ? AND end IS NULL ORDER BY start",
+                (kind,),
+            ).fetchall()
+        return [self.event_of(row) for row in rows]
+
+    def indexed_files(self) -> set[str]:
+        with self.lock:
+            rows = self.connection.execute("SELECT file FROM indexed_files").fetchall()
+        return set(row[0] for row in rows)
+
+    def event_files(self) -> set[str]:
+        with self.lock:
+            rows = self.connection.execute(
+                "SELECT DISTINCT file FROM events WHERE file IS NOT NULL"
+            ).fetchall()
+        return set(row[0] for row in rows)
+
+    def add_indexed_file(
+        self, file: str, events: list[tuple[str, datetime, datetime | None]]
+    ) -> None:
+        """
+        add the (kind, start, end) events found in a recording and mark the recording as scanned, in one transaction
+        so that an interrupted backfill never indexes a file twice
+        """
+        with self.lock, self.connection:
+            self.connection.executemany(
+                "INSERT INTO events (kind, start, end, file) VALUES (?, ?, ?, ?)",
+                [
+                    (kind, start.timestamp(), end and end.timestamp(), file)
+                    for kind, start, end in events
+                ],
+            )
+            self.connection.execute(
+                "INSERT OR IGNORE INTO indexed_files (file) VALUES (?)", (file,)
+            )
+
+    def pin(self, event_id: int, pinned: bool = True) -> None:
+        with self.lock, self.connection:
+            self.connection.execute(
+                "UPDATE events SET pinned = ? WHERE id = ?", (int(pinned), event_id)
+            )
+
+    def pinned(self) -> list[Event]:
+        with self.lock:
+            rows = self.connection.execute(
+                "SELECT id, kind, start, end, file, pinned FROM events "
+                "WHERE pinned != 0 ORDER BY start"
+            ).fetchall()
+        return [self.event_of(row) for row in rows]
+
+    def get(self, event_id: int) -> Event | None:
+        with self.lock:
+            row = self.connection.execute(
+                "SELECT id, kind, start, end, file, pinned FROM events WHERE id = ?",
+                (event_id,),
+            ).fetchone()
+        return None if row is None else self.event_of(row)
+
+    def query(self, start: datetime, end: datetime) -> list[Event]:
+        """events that overlap with [start, end)"""
+        with self.lock:
+            rows = self.connection.execute(
+                "SELECT id, kind, start, end, file, pinned FROM events "
+                "WHERE start < ? AND (end IS NULL OR end >= ?) ORDER BY start",
+                (end.timestamp(), start.timestamp()),
+            ).fetchall()
+        return [self.event_of(row) for row in rows]
+
+    def buckets(
+        self, start: datetime, end: datetime, resolution: int, offset: int = 0
+    ) -> list[tuple[int, str, int]]:
+        """
+        (bucket, kind, count) of the events that start in [start, end), where bucket is
+        (start + offset) // resolution; `offset` aligns the buckets to local days (the UTC offset in seconds)
+        """
+        with self.lock:
+            rows = self.connection.execute(
+                "SELECT CAST((start + ?) / ? AS INTEGER) AS bucket, kind, COUNT(*) "
+                "FROM events WHERE start >= ? AND start < ? GROUP BY bucket, kind ORDER BY bucket",
+                (offset, resolution, start.timestamp(), end.timestamp()),
+            ).fetchall()
+        return [(bucket, kind, count) for bucket, kind, count in rows]
+
+    def recent(self, count: int = 20) -> list[Event]:
+        with self.lock:
+            rows = self.connection.execute(
+                "SELECT id, kind, start, end, file, pinned FROM events "
+                "ORDER BY start DESC LIMIT ?",
+                (count,),
+            ).fetchall()
+        return [self.event_of(row) for row in rows]
+
+    @staticmethod
+    def event_of(row: tuple) -> Event:
+        event_id, kind, start, end, file, pinned = row
+        return Event(
+            id=event_id,
+            kind=kind,
+            start=datetime.fromtimestamp(start),
+            end=None if end is None else datetime.fromtimestamp(end),
+            file=file,
+            pinned=bool(pinned),
+        )
+
+
+if __name__ == "__main__":
+    main()
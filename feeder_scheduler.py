@@ -0,0 +1,135 @@
+import os
+import sys
+import time
+import asyncio
+from typing import Callable
+import logging
+from logging import getLogger
+from datetime import datetime
+from wet_feeder import WetFoodFeeder
+from plate_state import OPEN, CLOSED
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+class FeederScheduler:
+    """
+    the only path from the controller to the wet feeder: the controller states what it wants (`request`), never waits
+    for the cloud, and the scheduler makes the lid follow
+    - latest wins: a request replaces the pending one, so open, close, open within seconds is one command (or none)
+    - at most one command in flight, so the cloud never sees them out of order
+    - a change of state is sent at least `min_dwell` seconds after the previous one
+    - a failed command is sent again with a backoff until it succeeds or the intent changes, so the lid always ends
+        in the last requested state; `resend` forces the same after the camera saw it did not move
+    - a command that takes more than `command_timeout` seconds is abandoned and counts as failed, so a stalled
+        cloud call does not hold the only slot for the 5 minutes of the aiohttp default
+    - `on_sent` is called with the state of each command that reached the cloud (see `PlateMonitor.sent`)
+    """
+
+    def __init__(
+        self,
+        feeder: WetFoodFeeder,
+        plate: int = 1,
+        min_dwell: float = 5,
+        max_backoff: float = 30,
+        command_timeout: float = 20,
+        on_sent: Callable[[str], None] | None = None,
+    ):
+        self.feeder = feeder
+        self.plate = plate
+        self.min_dwell = min_dwell
+        self.max_backoff = max_backoff
+        self.command_timeout = command_timeout
+        self.on_sent = on_sent
+        self.intent: str | None = None
+        # the last command that succeeded, None when unknown
+        self.applied: str | None = None
+        self.applied_at = 0.0
+        self.in_flight: str | None = None
+        self.coalesced = 0  # requests replaced before they were sent, since the start
+        self.failures = 0
+        self.wakeup = asyncio.Event()
+        self.task: asyncio.Task | None = None
+
+    def start(self) -> None:
+        self.task = asyncio.create_task(self._run())
+
+    def stop(self) -> None:
+        if self.task is not None:
+            self.task.cancel()
+
+    def request(self, state: str) -> None:
+        assert state in (OPEN, CLOSED)
+        if (
+            self.intent != state
+            and self.intent != self.applied
+            and self.intent != self.in_flight
+        ):
+            self.coalesced += 1  # the previous intent was never sent
+        self.intent = state
+        self.wakeup.set()
+
+    def resend(self) -> None:
+        """
+        the device is not in the state of the last command after all
+        """
+        self.applied = None
+        self.wakeup.set()
+
+    async def _run(self) -> None:
+        backoff = 1.0
+        while True:
+            if self.intent is None or self.intent == self.applied:
+                self.wakeup.clear()
+                await self.wakeup.wait()
+                continue
+            # the dwell only applies between two different states: a failed or forced resend goes at once
+            if self.applied is not None:
+                wait = self.applied_at + self.min_dwell - time.monotonic()
+                if wait > 0:
+                    self.wakeup.clear()
+                    try:
+                        # a request during the dwell may cancel the change altogether
+                        await asyncio.wait_for(self.wakeup.wait(), wait)
+                    except asyncio.TimeoutError:
+                        pass
+                    continue
+            state = self.intent
+            self.in_flight = state
+            try:
+                if state == OPEN:
+                    command = self.feeder.manual_feed_now(self.plate)
+                else:
+                    command = self.feeder.stop_feed_now()
+                await asyncio.wait_for(command, self.command_timeout)
+            except Exception as e:
+                self.failures += 1
+                reason = str(e) or type(e).__name__  # a timeout has no message
+                _LOGGER.error(
+                    f"Failed to {'open' if state == OPEN else 'close'} the plate ({reason}), retrying in "
+                    + f"{backoff:.0f}s at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+                if self.intent == state:
+                    # the same intent after the backoff, a new one right away
+                    self.wakeup.clear()
+                    try:
+                        await asyncio.wait_for(self.wakeup.wait(), backoff)
+                    except asyncio.TimeoutError:
+                        pass
+                backoff = min(backoff * 2, self.max_backoff)
+                continue
+            finally:
+                self.in_flight = None
+            backoff = 1.0
+            if state != self.applied:
+                self.applied_at = time.monotonic()
+            self.applied = state
+            if self.on_sent is not None:
+                self.on_sent(state)
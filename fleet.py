@@ -0,0 +1,197 @@
+import os
+import sys
+import json
+import time
+import socket
+import struct
+import asyncio
+from dataclasses import dataclass, field
+from typing import Any
+import logging
+from logging import getLogger
+from datetime import datetime
+import arguably
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+# the same as `HEARTBEAT_GROUP` and `HEARTBEAT_PORT` in dry_feeder.ino
+GROUP = "239.255.42.1"
+PORT = 42100
+HEARTBEAT_INTERVAL = 5  # s, of the boards
+
+
+def main():
+
+    @arguably.command
+    def watch(*, stale_after: float = 3 * HEARTBEAT_INTERVAL):
+        """
+        print the fleet table whenever a heartbeat arrives
+        """
+
+        async def run():
+            fleet = Fleet(stale_after=stale_after)
+            await fleet.start()
+            while True:
+                await fleet.changed.wait()
+                fleet.changed.clear()
+                print("\033[2J\033[H" + fleet.table(), flush=True)
+
+        asyncio.run(run())
+
+    arguably.run()
+
+
+@dataclass
+class Board:
+    """
+    the last heartbeat of one board, and what the listener learned from the sequence of them
+    """
+
+    id: str
+    address: str  # of the sender, the `ip` of the heartbeat may be stale after a DHCP renewal
+    data: dict[str, Any]
+    seen_at: float  # time.monotonic()
+    first_seen: float = field(default_factory=time.time)
+    reboots: int = 0  # seen by the listener: the uptime went back
+    lost: int = 0  # heartbeats missing from the sequence
+
+    def age(self, now: float | None = None) -> float:
+        return (time.monotonic() if now is None else now) - self.seen_at
+
+
+class Fleet:
+    """
+    the boards on the network, from the multicast heartbeats they send every few seconds (see dry_feeder.ino): one
+    packet per board per interval tells every listener which boards are there, at which address, and their counters,
+    instead of each dashboard polling each board
+    - a board is alive while its last heartbeat is younger than `stale_after`
+    - `changed` is set at every heartbeat, for whoever wants to react to it
+    - several listeners can run on one host (the socket is shared with SO_REUSEPORT)
+    """
+
+    def __init__(
+        self,
+        group: str = GROUP,
+        port: int = PORT,
+        stale_after: float = 3 * HEARTBEAT_INTERVAL,
+        interface: str = "0.0.0.0",
+    ):
+        self.group = group
+        self.port = port
+        self.stale_after = stale_after
+        self.interface = interface
+        self.boards: dict[str, Board] = {}
+        self.changed = asyncio.Event()
+        self.transport: asyncio.DatagramTransport | None = None
+
+    async def start(self) -> None:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        if hasattr(socket, "SO_REUSEPORT"):
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+        sock.bind(("", self.port))
+        membership = struct.pack(
+            "4s4s", socket.inet_aton(self.group), socket.inet_aton(self.interface)
+        )
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+        sock.setblocking(False)
+        fleet = self
+
+        class Protocol(asyncio.DatagramProtocol):
+            def datagram_received(self, data: bytes, address: tuple[str, int]) -> None:
+                fleet.update(data, address[0])
+
+        self.transport, _ = await asyncio.get_running_loop().create_datagram_endpoint(
+            Protocol, sock=sock
+        )
+
+    def stop(self) -> None:
+        if self.transport is not None:
+            self.transport.close()
+
+    def update(
+        self, packet: bytes, address: str, now: float | None = None
+    ) -> Board | None:
+        now = time.monotonic() if now is None else now
+        try:
+            data = json.loads(packet)
+            board_id = str(data["id"])
+            sequence = int(data["sequence"])
+        except (ValueError, KeyError, TypeError):
+            _LOGGER.debug(f"Ignored a datagram from {address}: {packet[:64]!r}")
+            return None
+        board = self.boards.get(board_id)
+        if board is None:
+            board = Board(board_id, address, data, now)
+            self.boards[board_id] = board
+            _LOGGER.info(
+                f"Board {board_id} at {address} (version {data.get('version')}) at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+        else:
+            previous = int(board.data["sequence"])
+            if int(data.get("uptime", 0)) < int(board.data.get("uptime", 0)):
+                board.reboots += 1
+                _LOGGER.info(
+                    f"Board {board_id} rebooted at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+            elif sequence > previous:
+                board.lost += sequence - previous - 1
+            board.address = address
+            board.data = data
+            board.seen_at = now
+        self.changed.set()
+        return board
+
+    def is_alive(self, board: Board, now: float | None = None) -> bool:
+        return board.age(now) < self.stale_after
+
+    def alive(self, now: float | None = None) -> list[Board]:
+        return [board for board in self.boards.values() if self.is_alive(board, now)]
+
+    def status_of(self, board_id: str) -> dict[str, Any]:
+        """
+        the counters and the address of a live board, for the status gateway; raises `LookupError` when the board has
+        not been heard from for `stale_after`
+        """
+        board = self.boards.get(board_id)
+        if board is None:
+            raise LookupError(f"no heartbeat from {board_id}")
+        if not self.is_alive(board):
+            raise LookupError(f"no heartbeat from {board_id} for {board.age():.0f}s")
+        noisy = ("id", "sequence", "uptime", "queue_ms")  # change at every heartbeat
+        return {
+            **{k: v for k, v in board.data.items() if k not in noisy},
+            "address": board.address,
+        }
+
+    def table(self) -> str:
+        lines = [
+            f"{'board':<16} {'address':<16} {'version':>7} {'uptime':>9} {'age':>5} {'lost':>5} {'reboots':>7}  counters"
+        ]
+        now = time.monotonic()
+        for board in sorted(self.boards.values(), key=lambda board: board.id):
+            counters = " ".join(
+                f"{k.removesuffix('_count')}={v}"
+                for k, v in board.data.items()
+                if k.endswith("_count")
+            )
+            state = "" if self.is_alive(board, now) else " (down)"
+            lines.append(
+                f"{board.id:<16} {board.address:<16} {board.data.get('version', '?'):>7} "
+                + f"{board.data.get('uptime', 0):>8}s {board.age(now):>4.0f}s {board.lost:>5} {board.reboots:>7}  "
+                + counters
+                + state
+            )
+        return "\n".join(lines)
+
+
+if __name__ == "__main__":
+    main()
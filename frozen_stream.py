@@ -0,0 +1,103 @@
+import os
+import sys
+import time
+from dataclasses import dataclass, field
+import logging
+from logging import getLogger
+from cv2.typing import MatLike
+import numpy as np
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+@dataclass
+class FrozenStreamDetector:
+    """
+    the phone camera sometimes keeps delivering frames of a frozen image; `capture.read()` still succeeds, so this
+    checks the content instead: a sparse grid of luma samples is taken from every frame (no blur, no averaging,
+    so each sample keeps the full sensor noise) and compared with the previous one.
+    - the perceptual hash is a difference hash of the grid, one bit per pair of horizontal neighbours (is the right
+        one brighter): a frozen image that the decoder re-renders with a few different low bits keeps almost all
+        of them, whereas the noise of a live sensor flips the many bits of the flat areas
+    - frames are near-identical when their hashes differ by at most `hamming_threshold` bits, or when the mean
+        difference of their samples is below the noise floor (in a flat scene, a few low bits flip many hash bits)
+    A live stream never repeats the same samples for seconds: even a static scene is re-encoded with new noise at
+    every keyframe. A run of near-identical frames longer than `frozen_for` seconds means the stream is frozen.
+    A static dark scene can be encoded with skipped macroblocks only and repeat the same samples as well, and a
+    reconnect does not change that: every freeze that follows another without any change in between doubles the
+    wait (up to `max_frozen_for`), and at most `max_reconnects_per_hour` freezes are reported.
+    """
+
+    frozen_for: float = 10
+    max_frozen_for: float = 600
+    max_reconnects_per_hour: int = 6
+    near_threshold: float = 0.05  # mean absolute luma difference, in gray levels
+    hamming_threshold: int = 8  # of the 36 * 63 bits of the hash
+    columns: int = 64
+    rows: int = 36
+
+    last_samples: np.ndarray | None = field(default=None, init=False)
+    last_hash: np.ndarray | None = field(default=None, init=False)
+    same_since: float | None = field(default=None, init=False)
+    # the current backoff (`frozen_for` when None) and the reported freezes of the past hour
+    wait: float | None = field(default=None, init=False)
+    reconnects: list[float] = field(default_factory=list, init=False)
+
+    def reset(self) -> None:
+        # after a reconnect: the backoff and the reconnects of the past hour are kept
+        self.last_samples = None
+        self.last_hash = None
+        self.same_since = None
+
+    def samples_of(self, frame: MatLike) -> np.ndarray:
+        height, width = frame.shape[:2]
+        step_y = max(1, height // self.rows)
+        step_x = max(1, width // self.columns)
+        bgr = frame[step_y // 2 :: step_y, step_x // 2 :: step_x].astype(np.float32)
+        # ITU-R BT.601 luma, the same weights as cv2.COLOR_BGR2GRAY
+        return bgr[..., 0] * 0.114 + bgr[..., 1] * 0.587 + bgr[..., 2] * 0.299
+
+    @staticmethod
+    def hash_of(samples: np.ndarray) -> np.ndarray:
+        return samples[:, 1:] > samples[:, :-1]
+
+    def update(self, frame: MatLike, now: float | None = None) -> bool:
+        """
+        returns True if the stream has been frozen for more than the current wait (`frozen_for` at first), at which
+        point the caller reconnects
+        """
+        now = now or time.time()
+        samples = self.samples_of(frame)
+        frame_hash = self.hash_of(samples)
+        compared = (
+            self.last_samples is not None and self.last_samples.shape == samples.shape
+        )
+        same = compared and (
+            np.count_nonzero(frame_hash != self.last_hash) <= self.hamming_threshold
+            or float(np.abs(samples - self.last_samples).mean()) < self.near_threshold
+        )
+        self.last_samples = samples
+        self.last_hash = frame_hash
+        if not same:
+            self.same_since = None
+            if compared:  # the stream moved: not the first frame after a reconnect
+                self.wait = None
+            return False
+        if self.same_since is None:
+            self.same_since = now
+        wait = self.wait or self.frozen_for
+        if now - self.same_since <= wait:
+            return False
+        self.reconnects = [t for t in self.reconnects if now - t < 3600]
+        if len(self.reconnects) >= self.max_reconnects_per_hour:
+            return False
+        self.reconnects.append(now)
+        self.wait = min(wait * 2, self.max_frozen_for)
+        self.same_since = None
+        return True
@@ -0,0 +1,196 @@
+import pathlib
+import os
+import asyncio
+import sys
+import mmap
+import math
+import time
+from dataclasses import dataclass
+import logging
+from logging import getLogger
+from aiohttp import web
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+MAGIC = b"FEEDRRD1"
+
+
+@dataclass(frozen=True)
+class Archive:
+    resolution: int  # seconds per slot
+    slots: int
+
+
+# 1 hour at 1s, 1 week at 1min, 1 year at 1h: ~0.5MB per metric
+ARCHIVES = (Archive(1, 3600), Archive(60, 7 * 24 * 60), Archive(3600, 366 * 24))
+
+
+class Series:
+    """
+    round-robin archives of one metric in a memory-mapped file; each slot holds the bucket id (time // resolution)
+    and the sum, count, min and max of the values that fell into the bucket.
+    A slot whose bucket id is not the expected one is stale (the ring wrapped, or nothing was recorded).
+    """
+
+    def __init__(self, path: pathlib.Path, archives: tuple[Archive, ...] = ARCHIVES):
+        self.archives = archives
+        total_slots = sum(archive.slots for archive in archives)
+        # layout: magic, then all the bucket ids (int64), then all the values (4 x float32)
+        size = len(MAGIC) + total_slots * 8 + total_slots * 16
+        if not path.exists() or path.stat().st_size != size:
+            path.write_bytes(MAGIC + b"\0" * (size - len(MAGIC)))
+        self.file = open(path, "r+b")
+        self.map = mmap.mmap(self.file.fileno(), size)
+        assert self.map[: len(MAGIC)] == MAGIC, f"{path} is not a metrics file"
+        buckets = memoryview(self.map)[len(MAGIC) : len(MAGIC) + total_slots * 8]
+        values = memoryview(self.map)[len(MAGIC) + total_slots * 8 :]
+        self.buckets = buckets.cast("q")
+        self.values = values.cast("f")
+        self.offsets: list[int] = []
+        offset = 0
+        for archive in archives:
+            self.offsets.append(offset)
+            offset += archive.slots
+
+    def close(self) -> None:
+        self.buckets.release()
+        self.values.release()
+        self.map.flush()
+        self.map.close()
+        self.file.close()
+
+    def append(self, value: float, timestamp: float) -> None:
+        for archive, offset in zip(self.archives, self.offsets):
+            bucket = int(timestamp // archive.resolution)
+            slot = offset + bucket % archive.slots
+            base = slot * 4
+            if self.buckets[slot] != bucket:
+                self.buckets[slot] = bucket
+                self.values[base] = 0
+                self.values[base + 1] = 0
+                self.values[base + 2] = value
+                self.values[base + 3] = value
+            self.values[base] += value
+            self.values[base + 1] += 1
+            self.values[base + 2] = min(self.values[base + 2], value)
+            self.values[base + 3] = max(self.values[base + 3], value)
+
+    def query(
+        self, start: float, end: float, points: int = 300, now: float | None = None
+    ) -> tuple[int, list[list[float | None]]]:
+        """
+        returns the step (seconds) and the list of [time, mean, min, max] from start to end, with at most `points`
+        entries; buckets without any sample are reported as None
+        - the range is clamped to what the archives retain, so that the number of buckets visited is bounded by the
+            number of slots whatever start and end are asked for
+        """
+        now = now or time.time()
+        retained = max(archive.resolution * archive.slots for archive in self.archives)
+        start, end = max(start, now - retained), min(end, now)
+        if end <= start:
+            return self.archives[0].resolution, []
+        wanted = max(1, (end - start) / max(1, points))
+        # the finest archive that still reaches back to `start`, otherwise the coarsest one
+        index = len(self.archives) - 1
+        for i, archive in enumerate(self.archives):
+            if now - archive.resolution * archive.slots <= start:
+                index = i
+                break
+        archive, offset = self.archives[index], self.offsets[index]
+        step = archive.resolution * max(1, math.ceil(wanted / archive.resolution))
+        per_step = step // archive.resolution
+        series: list[list[float | None]] = []
+        first = int(start // step) * per_step
+        for group in range(first, int(end // archive.resolution) + 1, per_step):
+            total, count, low, high = 0.0, 0.0, math.inf, -math.inf
+            for bucket in range(group, group + per_step):
+                slot = offset + bucket % archive.slots
+                if self.buckets[slot] != bucket:
+                    continue
+                base = slot * 4
+                total += self.values[base]
+                count += self.values[base + 1]
+                low = min(low, self.values[base + 2])
+                high = max(high, self.values[base + 3])
+            t = group * archive.resolution
+            if count == 0:
+                series.append([t, None, None, None])
+            else:
+                series.append([t, total / count, low, high])
+        return step, series
+
+
+class MetricsStore:
+    """
+    in-process time-series store for feeder health (detector fps, capture outages, feeds, brightness, torch, ...)
+    appending a sample is O(1) and touches three slots in a memory-mapped file, so it is cheap to call every second
+    """
+
+    def __init__(self, folder: pathlib.Path = this_dir / "metrics"):
+        folder.mkdir(parents=True, exist_ok=True)
+        self.folder = folder
+        self.series: dict[str, Series] = {}
+
+    def __enter__(self) -> "MetricsStore":
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback) -> None:
+        self.close()
+
+    def close(self) -> None:
+        for series in self.series.values():
+            series.close()
+        self.series.clear()
+
+    def get(self, name: str) -> Series:
+        if name not in self.series:
+            assert name.isidentifier(), f"invalid metric name {name}"
+            self.series[name] = Series(self.folder / f"{name}.rrd")
+        return self.series[name]
+
+    def append(self, name: str, value: float, timestamp: float | None = None) -> None:
+        self.get(name).append(float(value), timestamp or time.time())
+
+    def names(self) -> list[str]:
+        return sorted(path.stem for path in self.folder.glob("*.rrd"))
+
+    def add_routes(self, app: web.Application) -> None:
+        app.router.add_get("/metrics", self.handle_names)
+        app.router.add_get("/metrics/{name}", self.handle_query)
+
+    async def handle_names(self, request: web.Request) -> web.Response:
+        return web.json_response(self.names())
+
+    async def handle_query(self, request: web.Request) -> web.Response:
+        """
+        GET /metrics/fps?start=<unix time>&end=<unix time>&points=300, by default the past hour
+        """
+        name = request.match_info["name"]
+        if name not in self.names():
+            raise web.HTTPNotFound(text=f"no metric {name}")
+        try:
+            end = float(request.query.get("end", time.time()))
+            start = float(request.query.get("start", end - 3600))
+            points = int(request.query.get("points", 300))
+        except ValueError:
+            raise web.HTTPBadRequest(text="start, end and points must be numbers")
+        if (
+            not (math.isfinite(start) and math.isfinite(end))
+            or end <= start
+            or points <= 0
+        ):
+            raise web.HTTPBadRequest(text="empty range")
+        # up to a year of hourly buckets: off the event loop, which also serves the video stream
+        step, series = await asyncio.get_running_loop().run_in_executor(
+            None, self.get(name).query, start, end, min(points, 5000)
+        )
+        return web.json_response({"name": name, "step": step, "series": series})
@@ -5,12 +5,18 @@ import pathlib
 import requests
 from datetime import datetime, timedelta
 from threading import Thread
+from typing import Callable
 import time
+import resource
 from logging import getLogger
 from cv2.typing import MatLike
 import numpy as np
 import logging
 import sys
+from event_index import EventIndex
+from frozen_stream import FrozenStreamDetector
+from motion_heatmap import MotionHeatmap
+from appearance import AppearanceIndex, signature_of_motion
 
 if "DEBUG" in os.environ:
 
@@ -21,6 +27,11 @@ _LOGGER = getLogger(__name__)
 
 this_dir = pathlib.Path(__file__).parent
 
+DILATE_KERNEL = np.ones((3, 3), np.uint8)
+DILATE_HALO = 2  # rows: two 3x3 dilations
+# BGR, the motion boxes drawn on the frames, so also in the recordings
+BOX_COLOR = (0, 255, 0)
+
 
 def main():
     with MotionDetector() as detector:
@@ -28,6 +39,12 @@ def main():
             time.sleep(1)
 
 
+def peak_rss_mb() -> float:
+    # the high-water mark of the resident memory of this process (ru_maxrss is in KB on Linux, in bytes on macOS)
+    maxrss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return maxrss / (1024 * 1024 if sys.platform == "darwin" else 1024)
+
+
 class MotionDetector:
     """
     motion is detected per 1 second interval (and it is recorded with one file per hour)
@@ -46,6 +63,7 @@ class MotionDetector:
         height: int = 1080,
         width: int = 1920,
         interval: float = 1,  # the event of detection
+        capture_url: str | None = None,  # the RTSP stream of the camera by default
     ):
 
         with open(this_dir / "credentials.json", "r") as f:
@@ -59,7 +77,7 @@ class MotionDetector:
         size_url = f"http://{self.base_url}/settings/video_size?set={width}x{height}"
         requests.get(size_url, auth=(username, password))
 
-        self.capture_url = f"rtsp://{self.base_url}/h264_ulaw.sdp"
+        self.capture_url = capture_url or f"rtsp://{self.base_url}/h264_ulaw.sdp"
         self.capture = cv2.VideoCapture(self.capture_url)
         # self.fps = self.capture.get(cv2.CAP_PROP_FPS)
         self.fps = 30.0  # hardcode it to 30 fps (there is a bug, see below)
@@ -67,6 +85,24 @@ class MotionDetector:
         self.width = int(self.capture.get(cv2.CAP_PROP_FRAME_WIDTH))
         self.height = int(self.capture.get(cv2.CAP_PROP_FRAME_HEIGHT))
         self.frame: MatLike | None = None
+        self.frames_read: int = 0  # sampled by the metrics store to compute the fps
+        # time.time() of the last iteration of the detector thread, to tell a live thread from a stuck one
+        self.progress_at: float = time.time()
+        # (generation, frame with the motion boxes drawn), replaced as a whole every second
+        self.snapshot: tuple[int, MatLike | None] = (0, None)
+        self.capture_ok: bool = True
+        # called from the detector thread after every 1 second tick (see `detector_process.py`)
+        self.on_tick: Callable[["MotionDetector"], None] | None = None
+        self.frozen = FrozenStreamDetector()
+        self.heatmap = MotionHeatmap()
+        # the blur is 21 pixels at 1080p
+        self.kernel = MotionKernel(
+            blur_size=max(3, int(21 * height / 1080) | 1), heatmap=self.heatmap
+        )
+        self.appearance = AppearanceIndex()
+        # who is moving (the nearest enrolled profile, or "unknown"), None without motion
+        self.identity: str | None = None
+        self.appearance_us: float = 0
         _LOGGER.debug(f"FPS: {self.fps}, Width: {self.width}, Height: {self.height}")
         assert self.fps > 0 and self.fps <= 120, "FPS is not correct"
         assert self.height == height, "Height is not updated"
@@ -75,6 +111,8 @@ class MotionDetector:
         self.is_motion_detected = False
         self.writer_hourly: cv2.VideoWriter | None = None
         self.writer_original: cv2.VideoWriter | None = None
+        self.events = EventIndex()
+        self.motion_event: int | None = None
 
     def __enter__(self) -> "MotionDetector":
         self.thread = Thread(target=self._thread_function)
@@ -82,14 +120,13 @@ class MotionDetector:
         return self
 
     def __exit__(self, exc_type, exc_value, traceback) -> None:
+        self.heatmap.save()
         if self.writer_original is not None:
             self.writer_original.release()
         if self.writer_hourly is not None:
             self.writer_hourly.release()
 
     def _thread_function(self) -> None:
-        reference_window: list[tuple[float, MatLike]] = []
-
         last_failed: bool = False
         last_time = time.time()
         now = datetime.now()
@@ -98,13 +135,10 @@ class MotionDetector:
             this_dir / "recordings" / f"hourly_{self.now_mp4()}",
             fps=1,
         )
-        motion_start_time: datetime | None = None
-        # if motion is detected but the frame is stable for more than 30 seconds,
-        # we will consider the motion is not real and soft reboot it quickly
-        last_grey: MatLike | None = None
-        count_stable_frames: int = 0
         while True:
+            self.progress_at = time.time()
             ret, frame = self.capture.read()
+            self.capture_ok = ret
             if not ret:
                 if not last_failed:
                     _LOGGER.error(
@@ -116,12 +150,7 @@ class MotionDetector:
                 if time.time() - last_time > 60:
                     last_time = time.time()
                     # if it does not recover after 1min, we will reinitialize the capture stream
-                    self.capture.release()
-                    self.capture = cv2.VideoCapture(self.capture_url)
-                    _LOGGER.error(
-                        "Reconnecting the video stream at "
-                        + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                    )
+                    self.reconnect()
                 continue
             else:
                 if last_failed:
@@ -132,6 +161,18 @@ class MotionDetector:
             last_failed = False
 
             # do the work that is done in every frame (30fps)
+            self.frames_read += 1
+            if self.frozen.update(frame):
+                # frames keep coming but the image is frozen: the read succeeds so we have to reconnect ourselves
+                _LOGGER.error(
+                    "Frozen video stream detected at "
+                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                )
+                self.capture_ok = False
+                self.reconnect()
+                # the reference may contain the frozen image
+                self.kernel.reference_window.clear()
+                continue
             if self.writer_original is not None:
                 self.writer_original.write(frame)
             self.frame = frame
@@ -151,116 +192,47 @@ class MotionDetector:
                     fps=1,
                 )
 
-            gray_frame = self.gray_frame_of(frame)
-
-            if len(reference_window) < 10:
-                if self.writer_hourly is not None:
-                    self.writer_hourly.write(frame)
-                reference_window.append((time.time(), gray_frame))
-                continue  # need to accumulate more frames before we start to do some processing
-            while len(reference_window) > 10:
-                reference_window.pop(0)  # remove the oldest frame
-
-            # calculate the average of the reference window
-            height, width = gray_frame.shape
-            average_reference = np.zeros((height, width), dtype=np.float32)
-            # excluding the current frame because it might contain motion
-            for history_gray_frame in reference_window:
-                average_reference += history_gray_frame[1].astype(np.float32)
-            average_reference /= len(reference_window)
-            gray_reference = average_reference.astype(np.uint8)
-
-            is_motion_detected = self.is_different(
-                gray_reference, gray_frame, frame_to_draw=frame
-            )
-            if is_motion_detected and not self.is_motion_detected:
-                motion_start_time = datetime.now()
-                _LOGGER.debug(
-                    "Motion started at "
-                    + motion_start_time.strftime("%Y-%m-%d %H:%M:%S")
-                )
+            was_motion_detected = self.is_motion_detected
+            self.is_motion_detected = self.kernel.update(frame, now)
+            self.identify(frame)  # before the boxes are drawn over the animal
+            self.kernel.draw(frame)
+            if self.is_motion_detected and not was_motion_detected:
                 self.start_recording_original()
-                count_stable_frames = 0
-            elif not is_motion_detected and self.is_motion_detected:
-                motion_start_time = None
-                _LOGGER.debug(
-                    "Motion ended at " + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                )
-                self.stop_recording_original()
-                count_stable_frames = 0
-            self.is_motion_detected = is_motion_detected
-
-            if not self.is_motion_detected:
-                reference_window.append((time.time(), gray_frame))
-
-            if last_grey is not None and is_motion_detected:
-                if self.is_different(last_grey, gray_frame, threshold_ratio=0.001):
-                    count_stable_frames = 0
-                else:
-                    count_stable_frames += 1
-                if count_stable_frames > 30:
-                    _LOGGER.debug(
-                        "Stable frames cause motion soft reboot at "
-                        + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                    )
-                    count_stable_frames = 0
-                    motion_start_time = None
-                    self.is_motion_detected = False
-                    self.stop_recording_original()
-                    reference_window.clear()  # soft reboot
-
-            last_grey = gray_frame
-
-            if (
-                motion_start_time is not None
-                and datetime.now() - motion_start_time > timedelta(minutes=20)
-            ):
-                _LOGGER.debug(
-                    "Motion soft reboot at "
-                    + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
-                )
-                motion_start_time = None
-                self.is_motion_detected = False
+            elif not self.is_motion_detected and was_motion_detected:
                 self.stop_recording_original()
-                reference_window.clear()  # soft reboot
+            self.snapshot = (self.snapshot[0] + 1, frame)
+            if self.on_tick is not None:
+                self.on_tick(self)
 
             if self.writer_hourly is not None:
                 self.writer_hourly.write(frame)
 
-    def is_different(
-        self,
-        frame1: MatLike,
-        frame2: MatLike,
-        *,
-        frame_to_draw: MatLike | None = None,
-        # the number 0.015 is calculated based on the size of the plate (~0.011)
-        threshold_ratio: float = 0.015,
-    ) -> bool:
-        frame_diff = cv2.absdiff(frame1, frame2)
-        thresh = cv2.threshold(frame_diff, 25, 255, cv2.THRESH_BINARY)[1]
-        thresh = cv2.dilate(thresh, kernel=np.ones((3, 3), np.uint8), iterations=2)
-
-        contours, _ = cv2.findContours(
-            thresh.copy(), cv2.RETR_EXTERNAL, cv2.CHAIN_APPROX_SIMPLE
+    def identify(self, frame: MatLike) -> None:
+        self.identity = None
+        if not self.is_motion_detected:
+            return
+        started = time.perf_counter()
+        signature = signature_of_motion(frame, self.kernel.boxes, self.kernel.mask)
+        if signature is not None:
+            self.appearance.reload()  # after `python3 appearance.py enroll`
+            self.identity = self.appearance.identify(signature)
+        self.appearance_us = (time.perf_counter() - started) * 1e6
+
+    def reconnect(self) -> None:
+        self.capture.release()
+        self.capture = cv2.VideoCapture(self.capture_url)
+        self.frozen.reset()
+        _LOGGER.error(
+            "Reconnecting the video stream at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
         )
 
-        is_motion_detected = False
-        threshold_area = threshold_ratio * frame1.shape[0] * frame1.shape[1]
-        for contour in contours:
-            if cv2.contourArea(contour) < threshold_area:
-                continue
-            (x, y, w, h) = cv2.boundingRect(contour)
-            is_motion_detected = True
-            if frame_to_draw is not None:
-                cv2.rectangle(frame_to_draw, (x, y), (x + w, y + h), (0, 255, 0), 2)
-        return is_motion_detected
-
     def start_recording_original(self) -> None:
         if self.writer_original is not None:
             return
-        self.writer_original = self.create_video_writer(
-            this_dir / "recordings" / f"original_{self.now_mp4()}"
-        )
+        filename = this_dir / "recordings" / f"original_{self.now_mp4()}"
+        self.writer_original = self.create_video_writer(filename)
+        self.motion_event = self.events.start("motion", file=filename.name)
 
     def create_video_writer(
         self, filename: pathlib.Path, fps: float | None = None
@@ -278,15 +250,245 @@ class MotionDetector:
             return
         self.writer_original.release()
         self.writer_original = None
+        if self.motion_event is not None:
+            self.events.end(self.motion_event)
+            self.motion_event = None
 
     def now_mp4(self) -> str:
         return datetime.now().strftime("%Y-%m-%d_%H-%M-%S") + ".mp4"
 
+
+class MotionKernel:
+    """
+    the detection that runs every 1 second, shared by the live `MotionDetector` and the backfill of old recordings
+    (see `backfill.py`); it only keeps the reference window and the motion state, the caller owns the recording
+    """
+
+    def __init__(
+        self,
+        blur_size: int = 21,
+        heatmap: MotionHeatmap | None = None,
+        strip_height: int = 64,
+    ):
+        self.blur_size = blur_size  # must be odd; scale it together with the frame
+        self.heatmap = heatmap
+        # the frame is processed in horizontal strips of `strip_height` rows, each with the rows above and below it
+        # that the blur and the dilation need (the halo): the temporaries are a few strips whatever the resolution,
+        # only the gray frames of the reference window and the mask are full frames
+        self.strip_height = strip_height
+        self.buffers: dict[str, np.ndarray] = {}
+        self.last_mask: MatLike | None = None  # of the last call to `is_different`
+        self.last_boxes: list[tuple[int, int, int, int]] = []  # (x, y, w, h)
+        # the motion mask and boxes of the current frame against the reference (see `appearance.py`)
+        self.mask: MatLike | None = None
+        self.boxes: list[tuple[int, int, int, int]] = []
+        self.reference_window: list[tuple[float, MatLike]] = []
+        self.is_motion_detected = False
+        self.motion_start_time: datetime | None = None
+        # if motion is detected but the frame is stable for more than 30 seconds,
+        # we will consider the motion is not real and soft reboot it quickly
+        self.last_grey: MatLike | None = None
+        self.count_stable_frames: int = 0
+
+    def soft_reboot(self) -> None:
+        self.count_stable_frames = 0
+        self.motion_start_time = None
+        self.is_motion_detected = False
+        self.reference_window.clear()
+
+    def update(
+        self, frame: MatLike, now: datetime, *, frame_to_draw: MatLike | None = None
+    ) -> bool:
+        """
+        process the frame of this second, returns whether motion is detected
+        """
+        gray_frame = self.gray_frame_of(frame)
+        reference_window = self.reference_window
+        self.mask = None
+        self.boxes = []
+
+        if len(reference_window) < 10:
+            reference_window.append((now.timestamp(), gray_frame))
+            # need to accumulate more frames before we start to do some processing
+            return self.is_motion_detected
+        while len(reference_window) > 10:
+            reference_window.pop(0)  # remove the oldest frame
+
+        # compared with the average of the reference window, computed strip by strip
+        # (excluding the current frame because it might contain motion)
+        is_motion_detected = self.find_motion(
+            self.reference_rows, gray_frame, frame_to_draw=frame_to_draw
+        )
+        self.mask = self.last_mask
+        self.boxes = self.last_boxes
+        if self.heatmap is not None and self.last_mask is not None:
+            self.heatmap.add(self.last_mask, now)
+        if is_motion_detected and not self.is_motion_detected:
+            self.motion_start_time = now
+            _LOGGER.debug("Motion started at " + now.strftime("%Y-%m-%d %H:%M:%S"))
+            self.count_stable_frames = 0
+        elif not is_motion_detected and self.is_motion_detected:
+            self.motion_start_time = None
+            _LOGGER.debug("Motion ended at " + now.strftime("%Y-%m-%d %H:%M:%S"))
+            self.count_stable_frames = 0
+        self.is_motion_detected = is_motion_detected
+
+        if not self.is_motion_detected:
+            reference_window.append((now.timestamp(), gray_frame))
+
+        if self.last_grey is not None and is_motion_detected:
+            if self.is_different(self.last_grey, gray_frame, threshold_ratio=0.001):
+                self.count_stable_frames = 0
+            else:
+                self.count_stable_frames += 1
+            if self.count_stable_frames > 30:
+                _LOGGER.debug(
+                    "Stable frames cause motion soft reboot at "
+                    + now.strftime("%Y-%m-%d %H:%M:%S")
+                )
+                self.soft_reboot()
+
+        self.last_grey = gray_frame
+
+        if (
+            self.motion_start_time is not None
+            and now - self.motion_start_time > timedelta(minutes=20)
+        ):
+            _LOGGER.debug("Motion soft reboot at " + now.strftime("%Y-%m-%d %H:%M:%S"))
+            self.soft_reboot()
+
+        return self.is_motion_detected
+
+    def is_different(
+        self,
+        frame1: MatLike,
+        frame2: MatLike,
+        *,
+        frame_to_draw: MatLike | None = None,
+        # the number 0.015 is calculated based on the size of the plate (~0.011)
+        threshold_ratio: float = 0.015,
+    ) -> bool:
+        return self.find_motion(
+            lambda first, last: frame1[first:last],
+            frame2,
+            frame_to_draw=frame_to_draw,
+            threshold_ratio=threshold_ratio,
+        )
+
+    def find_motion(
+        self,
+        reference_rows: Callable[[int, int], MatLike],
+        frame: MatLike,
+        *,
+        frame_to_draw: MatLike | None = None,
+        threshold_ratio: float = 0.015,
+    ) -> bool:
+        """
+        whether `frame` differs from the reference by more than `threshold_ratio` of its area in one place;
+        `reference_rows(first, last)` gives the rows [first, last) of the reference
+        """
+        height, width = frame.shape
+        # the mask is kept (heatmap, appearance): it is the only full-frame output
+        mask = np.empty((height, width), np.uint8)
+        for top, bottom, first, last in self.strips_of(height, DILATE_HALO):
+            diff = cv2.absdiff(
+                reference_rows(first, last),
+                frame[first:last],
+                dst=self.buffer("diff", last - first, width),
+            )
+            cv2.threshold(diff, 25, 255, cv2.THRESH_BINARY, dst=diff)
+            dilated = cv2.dilate(
+                diff,
+                kernel=DILATE_KERNEL,
+                dst=self.buffer("dilated", last - first, width),
+                iterations=2,
+            )
+            mask[top:bottom] = dilated[top - first : bottom - first]
+        self.last_mask = mask
+
+        # the source is not modified since OpenCV 3.2: no copy
+        contours, _ = cv2.findContours(mask, cv2.RETR_EXTERNAL, cv2.CHAIN_APPROX_SIMPLE)
+
+        is_motion_detected = False
+        self.last_boxes = []
+        threshold_area = threshold_ratio * height * width
+        for contour in contours:
+            if cv2.contourArea(contour) < threshold_area:
+                continue
+            x, y, w, h = cv2.boundingRect(contour)
+            is_motion_detected = True
+            self.last_boxes.append((x, y, w, h))
+            if frame_to_draw is not None:
+                cv2.rectangle(frame_to_draw, (x, y), (x + w, y + h), BOX_COLOR, 2)
+        return is_motion_detected
+
+    def draw(self, frame: MatLike) -> None:
+        """
+        draw the boxes of the last update on `frame`
+        """
+        for x, y, w, h in self.boxes:
+            cv2.rectangle(frame, (x, y), (x + w, y + h), BOX_COLOR, 2)
+
     def gray_frame_of(self, frame) -> MatLike:
-        gray_frame = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
-        gray_frame = cv2.GaussianBlur(gray_frame, (21, 21), 0)
+        height, width = frame.shape[:2]
+        gray_frame = np.empty((height, width), np.uint8)
+        for top, bottom, first, last in self.strips_of(height, self.blur_size // 2):
+            gray = cv2.cvtColor(
+                frame[first:last],
+                cv2.COLOR_BGR2GRAY,
+                dst=self.buffer("gray", last - first, width),
+            )
+            blurred = cv2.GaussianBlur(
+                gray,
+                (self.blur_size, self.blur_size),
+                0,
+                dst=self.buffer("blurred", last - first, width),
+            )
+            gray_frame[top:bottom] = blurred[top - first : bottom - first]
         return gray_frame
 
+    def reference_rows(self, first: int, last: int) -> MatLike:
+        """
+        the rows [first, last) of the average of the reference window
+        """
+        width = self.reference_window[0][1].shape[1]
+        total = self.buffer("total", last - first, width, np.float32)
+        total.fill(0)
+        for _, history_gray_frame in self.reference_window:
+            total += history_gray_frame[first:last]
+        total /= len(self.reference_window)
+        reference = self.buffer("reference", last - first, width)
+        np.copyto(reference, total, casting="unsafe")  # truncated like `astype`
+        return reference
+
+    def strips_of(self, height: int, halo: int):
+        """
+        (top, bottom, first, last) of each strip: it covers the rows [top, bottom) of the frame and is computed from
+        the rows [first, last), i.e. with `halo` more rows on each side except at the edges of the frame; the rows
+        of the halo are exact, so the result is the same as that of the whole frame at once
+        """
+        for top in range(0, height, self.strip_height):
+            bottom = min(top + self.strip_height, height)
+            yield top, bottom, max(0, top - halo), min(height, bottom + halo)
+
+    def buffer(
+        self, name: str, rows: int, width: int, dtype: type = np.uint8
+    ) -> np.ndarray:
+        """
+        the first `rows` rows of a reused strip buffer, large enough for any halo; reallocated when the width changes
+        """
+        buffer = self.buffers.get(name)
+        if (
+            buffer is None
+            or buffer.shape[0] < rows
+            or buffer.shape[1] != width
+            or buffer.dtype != dtype
+        ):
+            rows_needed = max(rows, self.strip_height + 2 * self.blur_size)
+            buffer = np.empty((rows_needed, width), dtype)
+            self.buffers[name] = buffer
+        return buffer[:rows]
+
 
 if __name__ == "__main__":
     main()
@@ -0,0 +1,104 @@
+import pathlib
+import os
+import sys
+import time
+from datetime import date, datetime
+from threading import Lock
+import logging
+from logging import getLogger
+import cv2
+from cv2.typing import MatLike
+import numpy as np
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+
+class MotionHeatmap:
+    """
+    where in the frame the activity happens: every detection tick adds 1 to the pixels of the thresholded difference
+    mask, with OpenCV's saturating (SIMD) add into a uint16 image at detection resolution, so the per-tick cost is
+    one vectorized pass over the mask. A day is saved as a 16-bit PNG (`heatmaps/heatmap_<day>.png`) when it rolls
+    over, and every `save_interval` seconds so that a restart keeps today's counts.
+    """
+
+    def __init__(
+        self,
+        folder: pathlib.Path = this_dir / "heatmaps",
+        save_interval: float = 600,
+    ):
+        folder.mkdir(parents=True, exist_ok=True)
+        self.folder = folder
+        self.save_interval = save_interval
+        self.lock = Lock()  # the detector adds while the HTTP API reads
+        self.day: date | None = None
+        self.counts: np.ndarray | None = None
+        self.last_save = time.time()
+
+    def path_of(self, day: date) -> pathlib.Path:
+        return self.folder / f"heatmap_{day.isoformat()}.png"
+
+    def add(self, mask: MatLike, now: datetime) -> None:
+        with self.lock:
+            if self.day != now.date() or self.counts is None:
+                self.roll_over(now.date(), mask.shape[:2])
+            assert self.counts is not None
+            if self.counts.shape != mask.shape[:2]:
+                _LOGGER.error(f"Heatmap resolution changed to {mask.shape[:2]}")
+                self.roll_over(now.date(), mask.shape[:2])
+            cv2.add(self.counts, 1, dst=self.counts, mask=mask)
+        if time.time() - self.last_save > self.save_interval:
+            self.save()
+
+    def roll_over(self, day: date, shape: tuple[int, ...]) -> None:
+        if self.counts is not None and self.day is not None:
+            cv2.imwrite(str(self.path_of(self.day)), self.counts)
+        self.day = day
+        self.counts = None
+        saved = self.path_of(day)
+        if saved.exists():  # restarted during the day
+            counts = cv2.imread(str(saved), cv2.IMREAD_UNCHANGED)
+            if counts is not None and counts.shape == shape:
+                self.counts = counts.astype(np.uint16)
+        if self.counts is None:
+            self.counts = np.zeros(shape, dtype=np.uint16)
+
+    def save(self) -> None:
+        with self.lock:
+            if self.counts is None or self.day is None:
+                return
+            counts = self.counts.copy()
+            day = self.day
+        cv2.imwrite(str(self.path_of(day)), counts)
+        self.last_save = time.time()
+
+    def get(self, day: date | None = None) -> np.ndarray | None:
+        """
+        the raw counts of a day (today by default), or None if nothing was recorded
+        """
+        with self.lock:
+            if self.counts is not None and (day is None or day == self.day):
+                return self.counts.copy()
+        if day is None:
+            # not in memory in this process (e.g. the detector runs in `DetectorProcess`): the last save of today
+            day = date.today()
+        if not self.path_of(day).exists():
+            return None
+        return cv2.imread(str(self.path_of(day)), cv2.IMREAD_UNCHANGED)
+
+    @staticmethod
+    def render(counts: np.ndarray) -> np.ndarray:
+        """
+        colorized heatmap for humans, normalized to the busiest pixel
+        """
+        peak = max(1, int(counts.max()))
+        normalized = cv2.convertScaleAbs(counts, alpha=255.0 / peak)
+        return cv2.applyColorMap(normalized, cv2.COLORMAP_JET)
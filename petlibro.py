@@ -23,6 +23,7 @@ from datetime import datetime, timedelta
 from aiohttp import ClientSession, ClientError
 
 import aiohttp
+import asyncio
 import uuid  # To generate unique request IDs
 
 
@@ -63,6 +64,8 @@ class PetLibroSession:
             "timezone": time_zone or "America/Chicago",
             "version": "1.3.45",
         }
+        # concurrent requests (`snapshot`, the feeder commands) that see an expired token log in once, not each
+        self.login_lock = asyncio.Lock()
 
     async def post(self, path: str, **kwargs: Any) -> JSON:
         """POST method for PetLibro API."""
@@ -119,8 +122,12 @@ class PetLibroSession:
                 _LOGGER.debug(
                     f"NOT_YET_LOGIN error occurred for {joined_url}. Trying re-login."
                 )
-                # Trigger a re-login and get the new token
-                new_token = await self.re_login()
+                # Trigger a re-login and get the new token, unless another request did while this one waited
+                stale_token = kwargs["headers"].get("token")
+                async with self.login_lock:
+                    if self.token is None or self.token == stale_token:
+                        await self.re_login()
+                new_token = self.token
                 kwargs["headers"]["token"] = new_token
                 _LOGGER.debug(f"Retrying request with new token: {new_token}")
 
@@ -643,6 +650,109 @@ class PetLibroAPI:
             "/device/wetFeedingPlan/wetListV3", serial
         )
 
+    # the read-only queries of a snapshot: name -> method; those of another product fail and are reported as errors
+    SNAPSHOT_ENDPOINTS = {
+        "base_info": "device_base_info",
+        "real_info": "device_real_info",
+        "data_real_info": "device_data_real_info",
+        "attribute_settings": "device_attribute_settings",
+        "grain_status": "device_grain_status",
+        "feeding_plan_today": "device_feeding_plan_today_new",
+        "wet_feeding_plan": "device_wet_feeding_plan",
+    }
+
+    async def snapshot(
+        self,
+        endpoints: List[str] | None = None,
+        serials: List[str] | None = None,
+        concurrency: int = 4,
+        deadline: float = 10,
+        call_timeout: float = 5,
+    ) -> Dict[str, Any]:
+        """
+        The devices of the account and their details, fetched concurrently.
+
+        After the device list, every (device, endpoint) query starts at once with at most `concurrency` of them in
+        flight, so a refresh takes about as long as the slowest query instead of the sum of them. They all share one
+        deadline, `deadline` seconds after the call, and each one is also cut after `call_timeout`. A query that fails
+        or misses the deadline is left out of its device and reported in "errors"; the others are kept.
+
+        :param endpoints: Names of `SNAPSHOT_ENDPOINTS`, all of them by default
+        :param serials: Only these devices, all of them by default
+        :raises RuntimeError: When the device list itself cannot be fetched
+        :return: {"devices": {serial: {"device": <list entry>, <endpoint>: data}}, "errors": {"<serial>/<endpoint>":
+            message}, "elapsed": seconds}
+        """
+        loop = asyncio.get_running_loop()
+        started = loop.time()
+        ends_at = started + deadline
+        names = list(self.SNAPSHOT_ENDPOINTS) if endpoints is None else endpoints
+        unknown = [name for name in names if name not in self.SNAPSHOT_ENDPOINTS]
+        if unknown:
+            raise ValueError(f"Unknown snapshot endpoints: {unknown}")
+
+        try:
+            devices = await asyncio.wait_for(
+                self.list_devices(), min(call_timeout, deadline)
+            )
+        except asyncio.TimeoutError:
+            raise RuntimeError("Timed out listing the devices")
+        devices = [
+            device
+            for device in devices or []
+            if serials is None or device.get("deviceSn") in serials
+        ]
+        result: Dict[str, Any] = {
+            "devices": {device["deviceSn"]: {"device": device} for device in devices},
+            "errors": {},
+        }
+
+        limit = asyncio.Semaphore(concurrency)
+
+        async def query(serial: str, name: str) -> Any:
+            async with limit:
+                remaining = ends_at - loop.time()
+                if remaining <= 0:
+                    raise asyncio.TimeoutError()
+                method = getattr(self, self.SNAPSHOT_ENDPOINTS[name])
+                return await asyncio.wait_for(
+                    method(serial), min(call_timeout, remaining)
+                )
+
+        tasks = {
+            (serial, name): asyncio.create_task(query(serial, name))
+            for serial in result["devices"]
+            for name in names
+        }
+        if tasks:
+            # the queries still waiting for a slot at the deadline are cancelled with the slow ones
+            _, pending = await asyncio.wait(
+                tasks.values(), timeout=max(0, ends_at - loop.time())
+            )
+            for task in pending:
+                task.cancel()
+            await asyncio.gather(*pending, return_exceptions=True)
+        for (serial, name), task in tasks.items():
+            if task.cancelled():
+                error: BaseException | None = asyncio.TimeoutError()
+            else:
+                error = task.exception()
+            if error is None:
+                result["devices"][serial][name] = task.result()
+            else:
+                message = (
+                    "deadline exceeded"
+                    if isinstance(error, asyncio.TimeoutError)
+                    else str(error)
+                )
+                result["errors"][f"{serial}/{name}"] = message
+        result["elapsed"] = round(loop.time() - started, 3)
+        _LOGGER.debug(
+            f"Snapshot of {len(devices)} devices, {len(tasks)} queries, "
+            f"{len(result['errors'])} errors in {result['elapsed']}s"
+        )
+        return result
+
     # Support for new switch functions
     async def set_feeding_plan(self, serial: str, enable: bool):
         """Set the feeding plan on/off."""
@@ -0,0 +1,264 @@
+import json
+import os
+import pathlib
+import sys
+import time
+from dataclasses import dataclass, field
+import logging
+from logging import getLogger
+from datetime import datetime
+import arguably
+import cv2
+from cv2.typing import MatLike
+import numpy as np
+import requests
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+OPEN = "open"
+CLOSED = "closed"
+TEMPLATE_SIZE = (64, 48)  # the ROI is downscaled to this before matching
+
+
+def main():
+
+    @arguably.command
+    def capture(
+        state: str,
+        *,
+        roi: str = "",
+        url: str = "http://localhost:8081/snapshot.jpg",
+    ):
+        """
+        save the plate as it is now as the `open` or `closed` template, from the snapshot of the running controller
+        (so without motion in front of the plate); `roi` is "x,y,w,h" as fractions of the frame, needed once
+        """
+        assert state in (OPEN, CLOSED), "the state is open or closed"
+        classifier = PlateClassifier()
+        if roi:
+            classifier.roi = tuple(float(value) for value in roi.split(","))
+        assert classifier.roi is not None, "please give the plate --roi first"
+        classifier.templates[state] = classifier.crop(frame_of_url(url))
+        classifier._normalized = None
+        classifier.save()
+        print(
+            f"saved the {state} template, scores now: {classifier.scores_of_url(url)}"
+        )
+
+    @arguably.command
+    def classify(*, url: str = "http://localhost:8081/snapshot.jpg"):
+        """
+        print the scores of the current snapshot against both templates
+        """
+        classifier = PlateClassifier()
+        frame = frame_of_url(url)
+        started = time.perf_counter()
+        state = classifier.classify(frame)
+        us = (time.perf_counter() - started) * 1e6
+        print(f"{state} {classifier.scores} ({us:.0f}us)")
+
+    arguably.run()
+
+
+def frame_of_url(url: str) -> MatLike:
+    response = requests.get(url, timeout=10)
+    response.raise_for_status()
+    frame = cv2.imdecode(np.frombuffer(response.content, np.uint8), cv2.IMREAD_COLOR)
+    assert frame is not None, f"no image at {url}"
+    return frame
+
+
+def normalized(patch: MatLike) -> np.ndarray:
+    # zero mean and unit variance: the correlation of two of them is their mean product
+    values = patch.astype(np.float32).ravel()
+    values -= values.mean()
+    return values / max(float(values.std()), 1e-3)
+
+
+class PlateClassifier:
+    """
+    whether the lid of the wet feeder is open or closed, from the camera: the plate ROI is downscaled to a small
+    gray patch and compared with the cached open and closed templates by normalized correlation (zero mean, unit
+    variance, so the exposure and the torch do not matter); ~0.1ms per frame
+    - the state is the better template if it scores at least `min_score` and beats the other by `min_margin`,
+        else None (e.g. the cat's head is in front of the plate)
+    - the templates and the ROI live in `plate_templates/`, made with `python3 plate_state.py capture`
+    """
+
+    def __init__(
+        self,
+        folder: pathlib.Path = this_dir / "plate_templates",
+        min_score: float = 0.5,
+        min_margin: float = 0.1,
+    ):
+        self.folder = folder
+        self.min_score = min_score
+        self.min_margin = min_margin
+        self.roi: tuple[float, ...] | None = (
+            None  # x, y, w, h as fractions of the frame
+        )
+        self.templates: dict[str, MatLike] = {}
+        self.scores: dict[str, float] = {}  # of the last frame
+        self._normalized: dict[str, np.ndarray] | None = None
+        self.load()
+
+    @property
+    def ready(self) -> bool:
+        return self.roi is not None and len(self.templates) == 2
+
+    @property
+    def normalized(self) -> dict[str, np.ndarray]:
+        # the templates only change with `capture`
+        if self._normalized is None:
+            self._normalized = {
+                state: normalized(template)
+                for state, template in self.templates.items()
+            }
+        return self._normalized
+
+    def load(self) -> None:
+        if (self.folder / "roi.json").exists():
+            with open(self.folder / "roi.json", "r") as f:
+                self.roi = tuple(json.load(f))
+        for state in (OPEN, CLOSED):
+            path = self.folder / f"{state}.png"
+            if path.exists():
+                self.templates[state] = cv2.imread(str(path), cv2.IMREAD_GRAYSCALE)
+
+    def save(self) -> None:
+        self.folder.mkdir(parents=True, exist_ok=True)
+        with open(self.folder / "roi.json", "w") as f:
+            json.dump(self.roi, f)
+        for state, template in self.templates.items():
+            cv2.imwrite(str(self.folder / f"{state}.png"), template)
+
+    def crop(self, frame: MatLike) -> MatLike:
+        assert self.roi is not None
+        height, width = frame.shape[:2]
+        x, y, w, h = self.roi
+        patch = frame[
+            int(y * height) : int((y + h) * height),
+            int(x * width) : int((x + w) * width),
+        ]
+        # linear, not area: 20x cheaper for a non-integer ratio, and the correlation averages the aliasing out
+        patch = cv2.resize(patch, TEMPLATE_SIZE, interpolation=cv2.INTER_LINEAR)
+        return cv2.cvtColor(patch, cv2.COLOR_BGR2GRAY)
+
+    def classify(self, frame: MatLike) -> str | None:
+        if not self.ready:
+            return None
+        patch = normalized(self.crop(frame))
+        self.scores = {
+            state: float(np.dot(patch, template) / patch.size)
+            for state, template in self.normalized.items()
+        }
+        best, other = sorted(self.scores, key=lambda state: -self.scores[state])
+        if (
+            self.scores[best] < self.min_score
+            or self.scores[best] - self.scores[other] < self.min_margin
+        ):
+            return None
+        return best
+
+    def scores_of_url(self, url: str) -> dict[str, float]:
+        self.classify(frame_of_url(url))
+        return {state: round(score, 3) for state, score in self.scores.items()}
+
+
+@dataclass
+class PlateMonitor:
+    """
+    closes the loop around the cloud commands: every command sets the expected state, and the camera has to show it
+    within `confirm_seconds` (the cloud round trip and the lid travel); otherwise the same command is due again, at
+    most `retries` times, and then the monitor gives up until the next command
+    - `update` is called by the controller once per loop with the latest snapshot, which only costs a classification
+        when the detector produced a new frame: the state is seen at most a second after the lid moved
+    - nothing is ever polled from the cloud
+    """
+
+    classifier: PlateClassifier = field(default_factory=PlateClassifier)
+    confirm_seconds: float = 10
+    retries: int = 2
+
+    state: str | None = field(default=None, init=False)  # as seen by the camera
+    state_at: float | None = field(default=None, init=False)
+    generation: int = field(default=-1, init=False)
+    expected: str | None = field(default=None, init=False)
+    sent_at: float = field(default=0, init=False)
+    attempts: int = field(default=0, init=False)
+    failures: int = field(
+        default=0, init=False
+    )  # commands given up on, since the start
+    failed: str | None = field(
+        default=None, init=False
+    )  # the last one, until the controller handles it
+
+    @property
+    def enabled(self) -> bool:
+        return self.classifier.ready
+
+    def sent(self, expected: str, now: float | None = None) -> None:
+        """
+        a command was sent (successfully or not: the camera decides); sending the unconfirmed state again is
+        one more attempt of the same command
+        """
+        if not self.enabled:
+            return  # no templates: nothing to confirm against
+        if expected != self.expected:
+            self.attempts = 0
+        self.expected = expected
+        self.sent_at = time.time() if now is None else now
+        self.attempts += 1
+        self.failed = None
+
+    def update(
+        self, snapshot: tuple[int, MatLike | None], now: float | None = None
+    ) -> str | None:
+        """
+        classify the new frame if any; returns the state whose command has to be sent again, if any
+        """
+        now = time.time() if now is None else now
+        generation, frame = snapshot
+        if frame is not None and generation != self.generation:
+            self.generation = generation
+            state = self.classifier.classify(frame)
+            if state is not None and state != self.state:
+                self.state = state
+                self.state_at = now
+            if state is not None and state == self.expected:
+                if self.attempts > 1:
+                    _LOGGER.info(
+                        f"Plate {state} after {self.attempts} attempts at "
+                        + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+                    )
+                self.expected = None
+        if self.expected is None or now - self.sent_at < self.confirm_seconds:
+            return None
+        if self.attempts > self.retries:
+            _LOGGER.error(
+                f"Plate still not {self.expected} after {self.attempts} attempts, giving up at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+            self.failures += 1
+            self.failed = self.expected
+            self.expected = None
+            return None
+        _LOGGER.error(
+            f"Plate not {self.expected} {self.confirm_seconds:.0f}s after the command, retrying at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+        self.sent_at = now  # counted as an attempt once it is sent
+        return self.expected
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,311 @@
+import os
+import sys
+import struct
+import asyncio
+import pathlib
+from dataclasses import dataclass
+import logging
+from logging import getLogger
+from datetime import datetime, timezone
+from aiohttp import web
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+# the boxes on the way from `moov` to the chunk offsets
+CONTAINERS = {b"moov", b"trak", b"mdia", b"minf", b"stbl", b"edts", b"dinf"}
+CHUNK_SIZE = 256 * 1024
+
+
+@dataclass
+class Box:
+    type: bytes
+    offset: int  # in the file, of the header
+    size: int  # with the header
+    header: int  # 8, or 16 with a 64-bit size
+
+
+def boxes_of(f, start: int, end: int) -> list[Box]:
+    boxes: list[Box] = []
+    offset = start
+    while offset + 8 <= end:
+        f.seek(offset)
+        size, kind = struct.unpack(">I4s", f.read(8))
+        header = 8
+        if size == 1:
+            (size,) = struct.unpack(">Q", f.read(8))
+            header = 16
+        elif size == 0:
+            size = end - offset  # up to the end of the file
+        if size < header or offset + size > end:
+            raise ValueError(f"truncated {kind!r} box at {offset}")
+        boxes.append(Box(kind, offset, size, header))
+        offset += size
+    return boxes
+
+
+def box_bytes(kind: bytes, payload: bytes) -> bytes:
+    if len(payload) + 8 < 2**32:
+        return struct.pack(">I4s", len(payload) + 8, kind) + payload
+    return struct.pack(">I4sQ", 1, kind, len(payload) + 16) + payload
+
+
+def relocated(data: bytes, shift: int, co64: bool) -> bytes:
+    """
+    the payload of a `moov` (or of one of its containers) with every chunk offset moved by `shift`; with `co64`,
+    the 32-bit `stco` tables become 64-bit `co64` ones
+    """
+    out = bytearray()
+    offset = 0
+    while offset + 8 <= len(data):
+        size, kind = struct.unpack_from(">I4s", data, offset)
+        header = 8
+        if size == 1:
+            (size,) = struct.unpack_from(">Q", data, offset + 8)
+            header = 16
+        elif size == 0:
+            size = len(data) - offset
+        payload = data[offset + header : offset + size]
+        if kind in CONTAINERS:
+            out += box_bytes(kind, relocated(payload, shift, co64))
+        elif kind in (b"stco", b"co64"):
+            # version and flags, entry count, then the offsets
+            count = struct.unpack_from(">I", payload, 4)[0]
+            width = "I" if kind == b"stco" else "Q"
+            offsets = struct.unpack_from(f">{count}{width}", payload, 8)
+            moved = [value + shift for value in offsets]
+            if kind == b"stco" and not co64:
+                out += box_bytes(kind, payload[:8] + struct.pack(f">{count}I", *moved))
+            else:
+                out += box_bytes(
+                    b"co64", payload[:8] + struct.pack(f">{count}Q", *moved)
+                )
+        else:
+            out += data[offset : offset + size]
+        offset += size
+    return bytes(out)
+
+
+def max_chunk_offset(data: bytes) -> int:
+    largest = 0
+    offset = 0
+    while offset + 8 <= len(data):
+        size, kind = struct.unpack_from(">I4s", data, offset)
+        header = 8
+        if size == 1:
+            (size,) = struct.unpack_from(">Q", data, offset + 8)
+            header = 16
+        elif size == 0:
+            size = len(data) - offset
+        payload = data[offset + header : offset + size]
+        if kind in CONTAINERS:
+            largest = max(largest, max_chunk_offset(payload))
+        elif kind in (b"stco", b"co64"):
+            count = struct.unpack_from(">I", payload, 4)[0]
+            width = "I" if kind == b"stco" else "Q"
+            if count > 0:
+                largest = max(
+                    largest, *struct.unpack_from(f">{count}{width}", payload, 8)
+                )
+        offset += size
+    return largest
+
+
+@dataclass
+class Layout:
+    """
+    a recording as served: a list of (bytes kept in memory) or (offset, length in the file) segments
+    """
+
+    segments: list[bytes | tuple[int, int]]
+    size: int
+    faststart: bool  # whether the moov was moved
+
+
+def layout_of(path: pathlib.Path) -> Layout:
+    """
+    the faststart layout of an MP4: `ftyp`, then the `moov` with its chunk offsets shifted by its own size, then
+    everything else in the original order; only the moov is read, the media is served from the file as is
+    """
+    file_size = path.stat().st_size
+    with open(path, "rb") as f:
+        boxes = boxes_of(f, 0, file_size)
+        kinds = [box.type for box in boxes]
+        if b"moov" not in kinds:
+            raise ValueError("no moov: the recording is still being written")
+        moov = boxes[kinds.index(b"moov")]
+        first_media = next((box for box in boxes if box.type == b"mdat"), None)
+        if (
+            first_media is None
+            or moov.offset < first_media.offset
+            or boxes[0].type != b"ftyp"
+        ):
+            # already faststart (or a layout we do not know): as it is
+            return Layout([(0, file_size)], file_size, faststart=False)
+        f.seek(moov.offset + moov.header)
+        payload = f.read(moov.size - moov.header)
+    head = [box for box in boxes if box.type == b"ftyp"]
+    rest = [box for box in boxes if box.type not in (b"ftyp", b"moov")]
+    head_size = sum(box.size for box in head)
+    # the media moves by the size of the new moov, which grows if the offsets need 64 bits
+    co64 = False
+    shift = len(box_bytes(b"moov", relocated(payload, 0, co64)))
+    if max_chunk_offset(payload) + shift >= 2**32:
+        co64 = True
+        shift = len(box_bytes(b"moov", relocated(payload, 0, co64)))
+    new_moov = box_bytes(b"moov", relocated(payload, shift, co64))
+    assert len(new_moov) == shift
+    segments: list[bytes | tuple[int, int]] = [(box.offset, box.size) for box in head]
+    segments.append(new_moov)
+    for box in rest:
+        # the boxes between ftyp and the moov, e.g. `free` and `mdat`; they are contiguous in practice
+        if isinstance(segments[-1], tuple) and sum(segments[-1]) == box.offset:
+            segments[-1] = (segments[-1][0], segments[-1][1] + box.size)
+        else:
+            segments.append((box.offset, box.size))
+    size = head_size + len(new_moov) + sum(box.size for box in rest)
+    return Layout(segments, size, faststart=True)
+
+
+def parse_range(header: str, size: int) -> tuple[int, int] | None:
+    """
+    (first, last) byte of a single `bytes=` range, clamped to the file; None if it is not satisfiable
+    """
+    unit, _, spec = header.partition("=")
+    if unit.strip() != "bytes" or "," in spec:
+        raise ValueError("only a single byte range is supported")
+    first, _, last = spec.strip().partition("-")
+    if first == "":
+        length = int(last)
+        if length == 0:
+            return None
+        return max(0, size - length), size - 1
+    start = int(first)
+    end = int(last) if last else size - 1
+    if start >= size or end < start:
+        return None
+    return start, min(end, size - 1)
+
+
+class RecordingsServer:
+    """
+    the recordings over HTTP for remote viewing, with range requests and a virtual faststart layout: OpenCV writes
+    the `moov` at the end, so a browser would have to download the whole file before playing; here the moov is
+    served first (with its chunk offsets shifted) and the media after it, straight from the original file
+    - GET /recordings: the names and sizes of the recordings
+    - GET /recordings/<name>: the recording, `Range: bytes=...` gives 206 Partial Content
+    - the relocated moov is computed once per file version (a few hundred KB at most) and kept in a small cache
+    """
+
+    def __init__(self, folder: pathlib.Path = this_dir / "recordings", cache: int = 32):
+        self.folder = folder
+        self.cache_size = cache
+        self.layouts: dict[str, tuple[tuple[float, int], Layout]] = {}
+
+    def add_routes(self, app: web.Application) -> None:
+        app.router.add_get("/recordings", self.handle_list)
+        app.router.add_get("/recordings/{name}", self.handle_recording)
+
+    def layout(self, path: pathlib.Path) -> Layout:
+        stat = path.stat()
+        version = (stat.st_mtime, stat.st_size)
+        cached = self.layouts.get(path.name)
+        if cached is not None and cached[0] == version:
+            return cached[1]
+        layout = layout_of(path)
+        self.layouts[path.name] = (version, layout)
+        while len(self.layouts) > self.cache_size:
+            self.layouts.pop(next(iter(self.layouts)))
+        return layout
+
+    async def handle_list(self, request: web.Request) -> web.Response:
+        recordings = [
+            {"name": path.name, "size": path.stat().st_size}
+            for path in sorted(self.folder.glob("*.mp4"))
+        ]
+        return web.json_response(recordings)
+
+    async def handle_recording(self, request: web.Request) -> web.StreamResponse:
+        name = request.match_info["name"]
+        path = self.folder / name
+        if "/" in name or not name.endswith(".mp4") or not path.is_file():
+            raise web.HTTPNotFound()
+        loop = asyncio.get_running_loop()
+        try:
+            layout = await loop.run_in_executor(None, self.layout, path)
+        except ValueError as e:
+            raise web.HTTPConflict(text=str(e))
+        stat = path.stat()
+        headers = {
+            "Accept-Ranges": "bytes",
+            "Content-Type": "video/mp4",
+            "ETag": f'"{int(stat.st_mtime)}-{stat.st_size}"',
+            "Last-Modified": datetime.fromtimestamp(
+                stat.st_mtime, timezone.utc
+            ).strftime("%a, %d %b %Y %H:%M:%S GMT"),
+            "Access-Control-Allow-Origin": "*",
+        }
+        first, last = 0, layout.size - 1
+        status = 200
+        range_header = request.headers.get("Range")
+        if_range = request.headers.get("If-Range")
+        if range_header and (if_range is None or if_range == headers["ETag"]):
+            try:
+                requested = parse_range(range_header, layout.size)
+            except ValueError:
+                requested = (first, last)  # not understood: the whole file
+            if requested is None:
+                raise web.HTTPRequestRangeNotSatisfiable(
+                    headers={"Content-Range": f"bytes */{layout.size}"}
+                )
+            first, last = requested
+            status = 206
+            headers["Content-Range"] = f"bytes {first}-{last}/{layout.size}"
+        headers["Content-Length"] = str(last - first + 1)
+        response = web.StreamResponse(status=status, headers=headers)
+        await response.prepare(request)
+        if request.method == "HEAD":
+            return response
+        with open(path, "rb") as f:
+            for chunk in self.chunks(layout, first, last + 1):
+                if isinstance(chunk, bytes):
+                    await response.write(chunk)
+                    continue
+                offset, length = chunk
+                while length > 0:
+                    data = await loop.run_in_executor(
+                        None, os.pread, f.fileno(), min(length, CHUNK_SIZE), offset
+                    )
+                    if not data:
+                        break  # the file was truncated meanwhile
+                    await response.write(data)
+                    offset += len(data)
+                    length -= len(data)
+        return response
+
+    @staticmethod
+    def chunks(layout: Layout, start: int, end: int):
+        """
+        the pieces of the virtual range [start, end): bytes, or (offset, length) to read from the file
+        """
+        position = 0
+        for segment in layout.segments:
+            length = len(segment) if isinstance(segment, bytes) else segment[1]
+            if position + length > start and position < end:
+                lo = max(start, position) - position
+                hi = min(end, position + length) - position
+                if isinstance(segment, bytes):
+                    yield segment[lo:hi]
+                else:
+                    yield (segment[0] + lo, hi - lo)
+            position += length
+            if position >= end:
+                return
@@ -0,0 +1,194 @@
+import os
+import sys
+import re
+import json
+import time
+import asyncio
+from dataclasses import dataclass
+from typing import Any, Awaitable, Callable
+import logging
+from logging import getLogger
+from datetime import datetime
+import aiohttp
+from aiohttp import web
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+CORS = {"Access-Control-Allow-Origin": "*"}  # home.html is opened from anywhere
+
+
+@dataclass
+class Source:
+    """
+    one device (or local component) of the status document, fetched every `interval` seconds by the gateway only
+    """
+
+    name: str
+    fetch: Callable[[], Awaitable[dict[str, Any]]]
+    interval: float
+    timeout: float = 5
+
+
+async def fetch_dry_feeder(session: aiohttp.ClientSession, url: str) -> dict[str, Any]:
+    """
+    the counters from the root page of the dry feeder (`<h3>meal count: 3</h3>`, ...)
+    """
+    async with session.get(url + "/") as response:
+        response.raise_for_status()
+        text = await response.text()
+    counts = re.findall(r"<h3>([a-z ]+) count: (\d+)</h3>", text)
+    return {name.replace(" ", "_") + "_count": int(count) for name, count in counts}
+
+
+class StatusGateway:
+    """
+    one status document for every dashboard, so that the devices (most of them serve one client at a time) are
+    polled at a fixed rate by the gateway only, however many dashboards are open
+    - each source is polled by its own task; its entry keeps the last good data, `ok` and the last `error`
+    - the version goes up only when an entry changes, and the document is encoded once per version
+    - the version restarts at 0 with the process, so the ETag and the event ids are `<epoch>-<version>`, the epoch
+        being the start time of the gateway in milliseconds
+    - GET /status: the document, with the epoch and version as ETag (304 when unchanged)
+    - GET /status/events: server-sent events, a `snapshot` first and then a `delta` with the changed entries per
+        version; a client that reconnects with `Last-Event-ID` only gets the deltas it missed (the last
+        `keep_deltas` are kept, older clients and clients of a previous process get a new snapshot)
+    """
+
+    def __init__(
+        self, sources: list[Source], keep_deltas: int = 64, heartbeat: float = 15
+    ):
+        self.sources = sources
+        self.keep_deltas = keep_deltas
+        self.heartbeat = heartbeat
+        self.epoch = int(time.time() * 1000)
+        self.version = 0
+        self.document: dict[str, Any] = {"version": 0, "updated": None, "sources": {}}
+        self.body = json.dumps(self.document).encode()
+        self.snapshot: tuple[int, bytes] | None = None  # (version, encoded event)
+        self.deltas: dict[int, bytes] = {}  # version -> the encoded event leading to it
+        self.changed = asyncio.Event()
+        self.tasks: list[asyncio.Task] = []
+
+    def add_routes(self, app: web.Application) -> None:
+        app.router.add_get("/status", self.handle_status)
+        app.router.add_get("/status/events", self.handle_events)
+
+    def start(self) -> None:
+        for source in self.sources:
+            self.tasks.append(asyncio.create_task(self._poll(source)))
+
+    def stop(self) -> None:
+        for task in self.tasks:
+            task.cancel()
+
+    async def _poll(self, source: Source) -> None:
+        while True:
+            started = time.monotonic()
+            entry: dict[str, Any]
+            try:
+                data = await asyncio.wait_for(source.fetch(), source.timeout)
+                entry = {"ok": True, "data": data, "error": None}
+            except asyncio.CancelledError:
+                raise
+            except Exception as e:
+                previous = self.document["sources"].get(source.name)
+                entry = {
+                    "ok": False,
+                    "data": previous and previous["data"],
+                    "error": str(e) or type(e).__name__,
+                }
+            self.update(source.name, entry)
+            elapsed = time.monotonic() - started
+            await asyncio.sleep(max(0, source.interval - elapsed))
+
+    def update(self, name: str, entry: dict[str, Any]) -> None:
+        previous = self.document["sources"].get(name)
+        if previous is not None and all(previous[k] == entry[k] for k in entry):
+            return
+        if previous is None or previous["ok"] != entry["ok"]:
+            _LOGGER.info(
+                f"Status of {name} is {'ok' if entry['ok'] else entry['error']} at "
+                + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+        now = time.time()
+        entry["since"] = now  # when the entry last changed
+        self.version += 1
+        self.document["version"] = self.version
+        self.document["updated"] = now
+        self.document["sources"][name] = entry
+        self.body = json.dumps(self.document).encode()
+        delta = {"version": self.version, "updated": now, "sources": {name: entry}}
+        self.deltas[self.version] = self.event_of("delta", self.tag(), delta)
+        self.deltas.pop(self.version - self.keep_deltas, None)
+        # wake up every stream at once, the next waiters get a new event
+        self.changed.set()
+        self.changed = asyncio.Event()
+
+    def tag(self) -> str:
+        return f"{self.epoch}-{self.version}"
+
+    def version_of(self, tag: str) -> int:
+        """
+        the version of an event id of this process, -1 for anything else
+        """
+        epoch, _, version = tag.partition("-")
+        if epoch != str(self.epoch) or not version.isdigit():
+            return -1
+        return int(version)
+
+    @staticmethod
+    def event_of(kind: str, tag: str, data: dict[str, Any]) -> bytes:
+        return f"event: {kind}\nid: {tag}\ndata: {json.dumps(data)}\n\n".encode()
+
+    def snapshot_event(self) -> bytes:
+        if self.snapshot is None or self.snapshot[0] != self.version:
+            self.snapshot = (
+                self.version,
+                self.event_of("snapshot", self.tag(), self.document),
+            )
+        return self.snapshot[1]
+
+    async def handle_status(self, request: web.Request) -> web.Response:
+        etag = f'"{self.tag()}"'
+        headers = {"ETag": etag, "Cache-Control": "no-cache", **CORS}
+        if request.headers.get("If-None-Match") == etag:
+            return web.Response(status=304, headers=headers)
+        return web.Response(
+            body=self.body, content_type="application/json", headers=headers
+        )
+
+    async def handle_events(self, request: web.Request) -> web.StreamResponse:
+        response = web.StreamResponse(
+            headers={
+                "Content-Type": "text/event-stream",
+                "Cache-Control": "no-cache",
+                **CORS,
+            }
+        )
+        await response.prepare(request)
+        version = self.version_of(request.headers.get("Last-Event-ID", ""))
+        try:
+            while True:
+                if version == self.version:
+                    changed = self.changed
+                    try:
+                        await asyncio.wait_for(changed.wait(), self.heartbeat)
+                    except asyncio.TimeoutError:
+                        await response.write(b": keep-alive\n\n")
+                    continue
+                if 0 <= version < self.version and version + 1 in self.deltas:
+                    version += 1
+                    await response.write(self.deltas[version])
+                else:
+                    # new client, or too far behind
+                    version = self.version
+                    await response.write(self.snapshot_event())
+        except ConnectionResetError:
+            pass  # the dashboard went away
+        return response
@@ -0,0 +1,556 @@
+import os
+import sys
+import json
+import time
+import asyncio
+import pathlib
+from typing import Any
+import logging
+from logging import getLogger
+from datetime import datetime
+import cv2
+import numpy as np
+import aiohttp
+from aiohttp import web
+import arguably
+from cv2.typing import MatLike
+from control_socket import call
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+# the scripts of the built-in scenes; times are in seconds from the start of the scene
+# - approach: a cat walks from the left edge to the plate in `duration`, stays `stay` and walks out the same way
+# - lights: the ambient light goes linearly to `to` (1 is daylight) in `duration`
+# - torch: the torch of the phone is switched, as the controller does through /enabletorch and /disabletorch
+# - freeze: the stream keeps delivering the same frame for `duration`
+# - drop: the stream is cut and refused for `duration`
+SCENES: dict[str, list[dict[str, Any]]] = {
+    "approach": [{"kind": "approach", "at": 15, "duration": 5, "stay": 60}],
+    "evening": [
+        {"kind": "lights", "at": 5, "duration": 60, "to": 0.15},
+        {"kind": "approach", "at": 80, "duration": 5, "stay": 45},
+        {"kind": "torch", "at": 150, "on": True},
+        {"kind": "approach", "at": 170, "duration": 5, "stay": 30},
+        {"kind": "torch", "at": 230, "on": False},
+        {"kind": "freeze", "at": 250, "duration": 20},
+        {"kind": "drop", "at": 290, "duration": 20},
+        {"kind": "approach", "at": 330, "duration": 5, "stay": 30},
+    ],
+}
+# the center of the plate in the frame: the middle of the ROI of plate_state.py
+PLATE = (0.515, 0.625)
+PLATE_RADIUS = 0.075  # of the width
+TORCH_LIGHT = 0.5  # added to the ambient light
+CAT_ASPECT = 1.3  # half width of the cat over its half height
+STAMP_BITS = 64  # 48 bits of milliseconds since the epoch, 16 bits of frame number
+# the gray levels of a 0 and a 1 of the stamp: once blurred, their difference is below the motion threshold (25)
+STAMP_LEVELS = (112, 144)
+TAIL = 10  # seconds after the last step
+
+
+def main():
+
+    @arguably.command
+    def serve(
+        *,
+        scene: str = "evening",
+        port: int = 8080,
+        fps: float = 15,
+        truth: str = "",
+        measure: bool = False,
+        loop: bool = False,
+    ):
+        """
+        serve a scene (a name of `SCENES` or a JSON file of steps) like the IP Webcam app; start the controller with
+        `--ip-port=localhost:8080 --capture-url=http://localhost:8080/video --simulated-feeder --no-audio-trigger`
+        - `truth`: also append the ground truth to this JSONL file
+        - `measure`: follow the controller through its control socket and print the latencies at the end
+        """
+
+        async def run():
+            camera = SyntheticCamera(Scene(steps_of(scene)), fps=fps, loop=loop)
+            app = web.Application()
+            camera.add_routes(app)
+            runner = web.AppRunner(app)
+            await runner.setup()
+            await web.TCPSite(runner, port=port).start()
+            probe = LatencyProbe() if measure else None
+            if probe is not None:
+                probe.start()
+            await camera.run()
+            if truth:
+                with open(truth, "a") as f:
+                    for event in camera.scene.truth:
+                        f.write(json.dumps(event) + "\n")
+            if probe is not None:
+                probe.stop()
+                print(json.dumps(probe.report(camera.scene.truth), indent=2))
+            await runner.cleanup()
+
+        asyncio.run(run())
+
+    @arguably.command
+    def render(
+        path: str,
+        *,
+        scene: str = "evening",
+        width: int = 1920,
+        height: int = 1080,
+        fps: float = 15,
+    ):
+        """
+        write a scene to an MP4 (and its ground truth next to it, as JSONL) as fast as it renders; the controller can
+        read it with `--capture-url=<path>`, which is good for the detection but not for the latencies
+        """
+        rendered = Scene(steps_of(scene), width=width, height=height)
+        writer = cv2.VideoWriter(
+            path, cv2.VideoWriter.fourcc(*"mp4v"), fps, (width, height)
+        )
+        started = time.time()
+        try:
+            for index in range(int(rendered.duration * fps)):
+                frame = rendered.render(index / fps, started + index / fps)
+                if frame is not None:  # a drop is a gap in the file
+                    writer.write(frame)
+        finally:
+            writer.release()
+        with open(pathlib.Path(path).with_suffix(".jsonl"), "w") as f:
+            for event in rendered.truth:
+                f.write(json.dumps(event) + "\n")
+
+    @arguably.command
+    def stamp(path: str):
+        """
+        print the stamp (render time and frame number) of an image, e.g. a /snapshot.jpg of the controller
+        """
+        image = cv2.imread(path)
+        print(read_stamp(image) if image is not None else "cannot read " + path)
+
+    arguably.run()
+
+
+def steps_of(scene: str) -> list[dict[str, Any]]:
+    if scene in SCENES:
+        return SCENES[scene]
+    with open(scene) as f:
+        return json.load(f)
+
+
+def end_of(step: dict[str, Any]) -> float:
+    if step["kind"] == "approach":
+        return step["at"] + 2 * step["duration"] + step["stay"]
+    return step["at"] + step.get("duration", 0)
+
+
+def cell_of(width: int) -> int:
+    # 8 pixels at 1080p, the blocks of JPEG
+    return max(4, width // 240)
+
+
+def draw_stamp(frame: MatLike, milliseconds: int, number: int) -> None:
+    """
+    the ground truth of the frame as a row of cells along its top edge: a 1 and a 0 as references, then
+    `STAMP_BITS` bits, least significant first; the cells are flat for JPEG, and of low contrast so that the bits
+    that change from frame to frame are neither motion nor a change that keeps a still scene from being stable
+    """
+    cell = cell_of(frame.shape[1])
+    value = (milliseconds & (2**48 - 1)) | ((number & 0xFFFF) << 48)
+    bits = [1, 0] + [(value >> bit) & 1 for bit in range(STAMP_BITS)]
+    for index, bit in enumerate(bits):
+        x = (index + 1) * cell
+        frame[cell : 2 * cell, x : x + cell] = STAMP_LEVELS[bit]
+
+
+def read_stamp(frame: MatLike) -> tuple[float, int] | None:
+    """
+    (render time, frame number) of a frame with a stamp, None if there is none
+    """
+    cell = cell_of(frame.shape[1])
+    gray = frame if frame.ndim == 2 else cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY)
+    y = cell + cell // 2
+    if gray.shape[0] <= y or gray.shape[1] <= (STAMP_BITS + 3) * cell:
+        return None
+    levels = [
+        int(gray[y, (index + 1) * cell + cell // 2]) for index in range(STAMP_BITS + 2)
+    ]
+    one, zero = levels[0], levels[1]
+    if one - zero < (STAMP_LEVELS[1] - STAMP_LEVELS[0]) / 2:
+        return None
+    middle = (one + zero) / 2
+    value = sum(1 << bit for bit, level in enumerate(levels[2:]) if level > middle)
+    return (value & (2**48 - 1)) / 1000, value >> 48
+
+
+class Scene:
+    """
+    a scripted scene rendered on demand: a static room with the plate, lit by the ambient light and the torch, with
+    sensor noise (a still scene is never frozen, see `FrozenStreamDetector`), and a dark blob for the cat; every frame
+    carries its render time and number (`draw_stamp`) and every change of the scene is written down in `truth` as
+    {"event", "time" (the render time of the first frame after the change), "frame"}
+    """
+
+    def __init__(
+        self,
+        steps: list[dict[str, Any]],
+        width: int = 1920,
+        height: int = 1080,
+        seed: int = 0,
+    ):
+        self.steps = sorted(steps, key=lambda step: step["at"])
+        self.duration = max((end_of(step) for step in self.steps), default=0) + TAIL
+        self.rng = np.random.default_rng(seed)
+        self.torch = False
+        self.steps_applied = 0
+        self.truth: list[dict[str, Any]] = []
+        self.number = 0
+        self.last_frame: MatLike | None = None
+        self.last_state: dict[str, Any] = {}
+        self.resize(width, height)
+
+    def resize(self, width: int, height: int) -> None:
+        self.width = width
+        self.height = height
+        rng = np.random.default_rng(1)
+        # a floor and a wall with some furniture, smooth enough for the blur to keep it still
+        room = cv2.resize(
+            rng.integers(70, 170, (9, 16, 3), dtype=np.uint8),
+            (width, height),
+            interpolation=cv2.INTER_CUBIC,
+        )
+        room[height // 2 :] = cv2.convertScaleAbs(room[height // 2 :], alpha=0.8)
+        cv2.ellipse(
+            room,
+            (int(PLATE[0] * width), int(PLATE[1] * height)),
+            (int(PLATE_RADIUS * width), int(PLATE_RADIUS * width * 0.45)),
+            0,
+            0,
+            360,
+            (225, 225, 230),
+            -1,
+        )
+        self.room = room
+        # a few noise frames, reused in turn: generating them for every frame costs more than the rest
+        self.noise = [
+            self.rng.integers(0, 7, (height, width, 3), dtype=np.uint8)
+            for _ in range(4)
+        ]
+        self.last_frame = None
+
+    def state_at(self, t: float) -> dict[str, Any]:
+        state: dict[str, Any] = {
+            "light": 1.0,
+            "cat": None,  # (x, y, radius)
+            "on_plate": False,
+            "freeze": False,
+            "drop": False,
+        }
+        for step in self.steps:
+            at = step["at"]
+            if t < at:
+                break
+            kind = step["kind"]
+            if kind == "lights":
+                progress = min(1.0, (t - at) / max(step["duration"], 1e-3))
+                state["light"] += (step["to"] - state["light"]) * progress
+            elif kind == "approach" and t < end_of(step):
+                walk, stay = step["duration"], step["stay"]
+                # from off the left edge to the plate, and back
+                if t < at + walk:
+                    progress = (t - at) / walk
+                elif t < at + walk + stay:
+                    progress = 1.0
+                else:
+                    progress = 1.0 - (t - at - walk - stay) / walk
+                radius = int(0.12 * self.height)
+                x0, y = -2 * radius, int(PLATE[1] * self.height) - radius // 2
+                x = x0 + (PLATE[0] * self.width - x0) * progress
+                # a live cat never stays perfectly still
+                x += 0.05 * radius * np.sin((t - at) * 2)
+                # visible, and part of the truth, only once some of it is inside the frame
+                if x + CAT_ASPECT * radius > 0:
+                    state["cat"] = (int(x), y, radius)
+                state["on_plate"] = (
+                    abs(x - PLATE[0] * self.width) < PLATE_RADIUS * self.width
+                )
+            elif kind in ("freeze", "drop") and t < at + step["duration"]:
+                state[kind] = True
+        return state
+
+    def render(self, t: float, now: float) -> MatLike | None:
+        """
+        the frame at `t` seconds into the scene, stamped with `now`; None while the stream is dropped
+        """
+        # the scripted torch switches once, the controller may switch it back
+        while (
+            self.steps_applied < len(self.steps)
+            and self.steps[self.steps_applied]["at"] <= t
+        ):
+            step = self.steps[self.steps_applied]
+            if step["kind"] == "torch":
+                self.torch = bool(step["on"])
+            self.steps_applied += 1
+        state = self.state_at(t)
+        state["torch"] = self.torch
+        if state["drop"]:
+            self.note(state, now)
+            return None
+        if state["freeze"] and self.last_frame is not None:
+            self.note(state, now)
+            return self.last_frame
+        self.number += 1
+        frame = self.room.copy()
+        if state["cat"] is not None:
+            x, y, radius = state["cat"]
+            cv2.ellipse(
+                frame,
+                (x, y),
+                (int(CAT_ASPECT * radius), radius),
+                0,
+                0,
+                360,
+                (40, 45, 50),
+                -1,
+            )
+        light = min(1.0, state["light"] + (TORCH_LIGHT if self.torch else 0))
+        frame = cv2.convertScaleAbs(frame, alpha=light)
+        cv2.add(frame, self.noise[self.number % len(self.noise)], dst=frame)
+        draw_stamp(frame, int(now * 1000), self.number)
+        self.last_frame = frame
+        self.note(state, now)
+        return frame
+
+    def note(self, state: dict[str, Any], now: float) -> None:
+        # the truth is the scene, whatever the stream shows of it (frozen or dropped)
+        changes = []
+        last = self.last_state
+        if (state["cat"] is None) != (last.get("cat") is None):
+            changes.append("cat_visible" if state["cat"] is not None else "cat_gone")
+        if state["on_plate"] != last.get("on_plate", False):
+            changes.append("cat_on_plate" if state["on_plate"] else "cat_off_plate")
+        if state["torch"] != last.get("torch", False):
+            changes.append("torch_on" if state["torch"] else "torch_off")
+        for kind in ("freeze", "drop"):
+            if state[kind] != last.get(kind, False):
+                changes.append(kind + ("_start" if state[kind] else "_end"))
+        for event in changes:
+            self.truth.append({"event": event, "time": now, "frame": self.number})
+            _LOGGER.debug(
+                f"Scene: {event} at " + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            )
+        self.last_state = state
+
+
+class SyntheticCamera:
+    """
+    the endpoints of the IP Webcam app that the controller uses, served from a `Scene` in real time
+    - GET /video: the frames as MJPEG (multipart/x-mixed-replace), for `--capture-url=http://localhost:8080/video`;
+        a drop closes the open streams and refuses new ones with 503
+    - GET /shot.jpg: the current frame
+    - GET /settings/video_size?set=1920x1080, /enabletorch, /disabletorch: as the app does
+    - GET /truth: the ground truth so far
+    """
+
+    def __init__(self, scene: Scene, fps: float = 15, loop: bool = False):
+        self.scene = scene
+        self.fps = fps
+        self.loop = loop
+        self.jpeg: bytes | None = None
+        self.dropped = False
+        self.new_frame = asyncio.Condition()
+
+    def add_routes(self, app: web.Application) -> None:
+        app.router.add_get("/video", self.handle_video)
+        app.router.add_get("/shot.jpg", self.handle_shot)
+        app.router.add_get("/settings/video_size", self.handle_video_size)
+        app.router.add_get("/enabletorch", self.handle_torch)
+        app.router.add_get("/disabletorch", self.handle_torch)
+        app.router.add_get("/truth", self.handle_truth)
+
+    async def run(self) -> None:
+        """
+        render the scene in real time, until its end (or forever with `loop`)
+        """
+        loop = asyncio.get_running_loop()
+        started = time.time()
+        index = 0
+        while True:
+            due = started + index / self.fps
+            await asyncio.sleep(max(0.0, due - time.time()))
+            t = time.time() - started
+            if t > self.scene.duration:
+                if not self.loop:
+                    return
+                started, index = time.time(), 0
+                self.scene.steps_applied = 0
+                continue
+            # rendering and encoding take a few tens of ms at 1080p: off the loop that serves the streams
+            jpeg = await loop.run_in_executor(None, self.encode, t, time.time())
+            index += 1
+            async with self.new_frame:
+                self.dropped = jpeg is None
+                if jpeg is not None:
+                    self.jpeg = jpeg
+                self.new_frame.notify_all()
+
+    def encode(self, t: float, now: float) -> bytes | None:
+        frame = self.scene.render(t, now)
+        if frame is None:
+            return None
+        return cv2.imencode(".jpg", frame, [cv2.IMWRITE_JPEG_QUALITY, 85])[1].tobytes()
+
+    async def handle_video(self, request: web.Request) -> web.StreamResponse:
+        if self.dropped:
+            raise web.HTTPServiceUnavailable()
+        response = web.StreamResponse(
+            headers={"Content-Type": "multipart/x-mixed-replace; boundary=frame"}
+        )
+        await response.prepare(request)
+        try:
+            while True:
+                async with self.new_frame:
+                    await self.new_frame.wait()
+                    jpeg = self.jpeg
+                if self.dropped or jpeg is None:
+                    break  # the connection is closed
+                await response.write(
+                    b"--frame\r\nContent-Type: image/jpeg\r\nContent-Length: "
+                    + str(len(jpeg)).encode()
+                    + b"\r\n\r\n"
+                    + jpeg
+                    + b"\r\n"
+                )
+        except ConnectionResetError:
+            pass
+        return response
+
+    async def handle_shot(self, request: web.Request) -> web.Response:
+        if self.dropped or self.jpeg is None:
+            raise web.HTTPServiceUnavailable()
+        return web.Response(body=self.jpeg, content_type="image/jpeg")
+
+    async def handle_video_size(self, request: web.Request) -> web.Response:
+        try:
+            width, height = (int(size) for size in request.query["set"].split("x"))
+        except (KeyError, ValueError):
+            raise web.HTTPBadRequest(text="set=<width>x<height>")
+        if (width, height) != (self.scene.width, self.scene.height):
+            self.scene.resize(width, height)
+        return web.Response(text="ok")
+
+    async def handle_torch(self, request: web.Request) -> web.Response:
+        self.scene.torch = request.path == "/enabletorch"
+        return web.Response(text="ok")
+
+    async def handle_truth(self, request: web.Request) -> web.Response:
+        return web.json_response(self.scene.truth)
+
+
+class LatencyProbe:
+    """
+    follows the running controller through its control socket (20 times a second) and, with the ground truth of the
+    scene, measures for each visit of the cat
+    - glass to motion: from the first frame showing the cat to the controller seeing the motion
+    - glass to decision: from the first frame showing the cat to the controller deciding to open the plate
+    - decision to command: from that decision to the command being accepted (by the cloud, or `SimulatedFeeder`)
+    - snapshot age: how old the frame the motion was decided on was (its stamp, read from /snapshot.jpg)
+    """
+
+    def __init__(
+        self,
+        interval: float = 0.05,
+        snapshot_url: str = "http://localhost:8081/snapshot.jpg",
+    ):
+        self.interval = interval
+        self.snapshot_url = snapshot_url
+        # (time, key, value) of every change seen
+        self.changes: list[tuple[float, str, Any]] = []
+        self.snapshot_ages: list[tuple[float, float]] = []  # (time of the motion, age)
+        self.task: asyncio.Task | None = None
+
+    def start(self) -> None:
+        self.task = asyncio.create_task(self._run())
+
+    def stop(self) -> None:
+        if self.task is not None:
+            self.task.cancel()
+
+    async def _run(self) -> None:
+        loop = asyncio.get_running_loop()
+        last: dict[str, Any] = {}
+        async with aiohttp.ClientSession() as session:
+            while True:
+                await asyncio.sleep(self.interval)
+                try:
+                    state = await loop.run_in_executor(
+                        None, lambda: call("state", timeout=1)
+                    )
+                except (OSError, RuntimeError):
+                    continue  # the controller is not (yet) running
+                now = time.time()
+                for key in ("is_motion_detected", "plate_intent", "plate_applied"):
+                    if key in state and state[key] != last.get(key):
+                        self.changes.append((now, key, state[key]))
+                        if key == "is_motion_detected" and state[key]:
+                            asyncio.create_task(self.snapshot_age(session, now))
+                last = state
+
+    async def snapshot_age(self, session: aiohttp.ClientSession, seen: float) -> None:
+        try:
+            async with session.get(self.snapshot_url) as response:
+                body = await response.read()
+        except aiohttp.ClientError:
+            return
+        frame = cv2.imdecode(np.frombuffer(body, np.uint8), cv2.IMREAD_COLOR)
+        stamp = read_stamp(frame) if frame is not None else None
+        if stamp is not None:
+            self.snapshot_ages.append((seen, seen - stamp[0]))
+
+    def first(self, key: str, value: Any, after: float, before: float) -> float | None:
+        return next(
+            (
+                t
+                for t, k, v in self.changes
+                if k == key and v == value and after <= t < before
+            ),
+            None,
+        )
+
+    def report(self, truth: list[dict[str, Any]]) -> dict[str, Any]:
+        def seconds(start: float | None, end: float | None) -> float | None:
+            return None if start is None or end is None else round(end - start, 3)
+
+        visits = []
+        arrivals = [event["time"] for event in truth if event["event"] == "cat_visible"]
+        for index, arrived in enumerate(arrivals):
+            until = arrivals[index + 1] if index + 1 < len(arrivals) else float("inf")
+            motion = self.first("is_motion_detected", True, arrived, until)
+            decision = self.first("plate_intent", "open", arrived, until)
+            command = (
+                self.first("plate_applied", "open", decision, until)
+                if decision is not None
+                else None
+            )
+            age = next((a for t, a in self.snapshot_ages if t == motion), None)
+            visits.append(
+                {
+                    "arrived": datetime.fromtimestamp(arrived).strftime("%H:%M:%S"),
+                    "glass_to_motion": seconds(arrived, motion),
+                    "glass_to_decision": seconds(arrived, decision),
+                    "decision_to_command": seconds(decision, command),
+                    "snapshot_age": None if age is None else round(age, 3),
+                }
+            )
+        return {"visits": visits, "truth": truth}
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,195 @@
+import os
+import sys
+import time
+import asyncio
+import pathlib
+from collections import OrderedDict
+import logging
+from logging import getLogger
+from datetime import datetime
+import cv2
+import numpy as np
+from aiohttp import web
+from event_index import EventIndex
+from detector_api import encode_jpeg
+
+
+if "DEBUG" in os.environ:
+
+    logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
+
+
+_LOGGER = getLogger(__name__)
+
+
+this_dir = pathlib.Path(__file__).parent
+
+# the zoom levels of the timeline, in seconds per bucket; the dashboard uses the same list
+RESOLUTIONS = (60, 300, 900, 3600, 6 * 3600, 24 * 3600)
+MAX_BUCKETS = 4096  # per request
+MAX_EVENTS_SPAN = 6 * 3600  # raw events are only served for a zoomed-in window
+SPRITE_TILES = 16  # consecutive buckets per sprite
+TILE_SIZE = (160, 90)
+
+
+def thumbnail_of(path: pathlib.Path) -> np.ndarray | None:
+    """
+    the first frame of a motion recording, i.e. the moment the motion started; it is a keyframe, so nothing else is
+    decoded
+    """
+    capture = cv2.VideoCapture(str(path))
+    try:
+        ret, frame = capture.read()
+    finally:
+        capture.release()
+    if not ret:
+        return None
+    return cv2.resize(frame, TILE_SIZE, interpolation=cv2.INTER_AREA)
+
+
+class TimelineAPI:
+    """
+    the data behind the event timeline of home.html, which renders weeks of events without ever holding them: the
+    dashboard asks for what is on screen at the current zoom only
+    - GET /timeline/buckets?start=&end=&resolution=900&offset=7200: the number of events of each kind per bucket of
+        `resolution` seconds, as [bucket, kind, count] where bucket is (timestamp + offset) // resolution; `offset`
+        is the UTC offset of the dashboard so that the buckets start at local midnight
+    - GET /timeline/events?start=&end=: the raw events of a window of at most 6 hours, for the zoomed-in levels
+    - GET /timeline/sprite.jpg?resolution=900&offset=7200&index=N: one JPEG with the thumbnails of the buckets
+        [16N, 16N + 16) side by side, each the first frame of the first motion recording of its bucket (dark when
+        there is none); they are decoded on demand, at most two sprites at a time, and the finished ones are cached
+        in memory and by the browser
+    """
+
+    def __init__(
+        self,
+        events: EventIndex,
+        folder: pathlib.Path = this_dir / "recordings",
+        cache: int = 256,
+    ):
+        self.events = events
+        self.folder = folder
+        self.cache_size = cache
+        # (resolution, offset, index) -> JPEG, only for sprites whose buckets are over
+        self.sprites: OrderedDict[tuple[int, int, int], bytes] = OrderedDict()
+        self.decoding = asyncio.Semaphore(2)
+
+    def add_routes(self, app: web.Application) -> None:
+        app.router.add_get("/timeline/buckets", self.handle_buckets)
+        app.router.add_get("/timeline/events", self.handle_events)
+        app.router.add_get("/timeline/sprite.jpg", self.handle_sprite)
+
+    @staticmethod
+    def number(request: web.Request, name: str, default: float | None = None) -> float:
+        try:
+            value = request.query.get(name)
+            if value is None:
+                if default is None:
+                    raise web.HTTPBadRequest(text=f"{name} is required")
+                return default
+            return float(value)
+        except ValueError:
+            raise web.HTTPBadRequest(text=f"{name} must be a number")
+
+    def resolution(self, request: web.Request) -> int:
+        resolution = int(self.number(request, "resolution"))
+        if resolution not in RESOLUTIONS:
+            raise web.HTTPBadRequest(text=f"resolution must be one of {RESOLUTIONS}")
+        return resolution
+
+    async def handle_buckets(self, request: web.Request) -> web.Response:
+        resolution = self.resolution(request)
+        offset = int(self.number(request, "offset", 0))
+        start = self.number(request, "start")
+        end = self.number(request, "end")
+        if end <= start or (end - start) / resolution > MAX_BUCKETS:
+            raise web.HTTPBadRequest(text=f"at most {MAX_BUCKETS} buckets")
+        buckets = self.events.buckets(
+            datetime.fromtimestamp(start),
+            datetime.fromtimestamp(end),
+            resolution,
+            offset,
+        )
+        return web.json_response(
+            {"resolution": resolution, "offset": offset, "buckets": buckets},
+            headers={"Access-Control-Allow-Origin": "*"},
+        )
+
+    async def handle_events(self, request: web.Request) -> web.Response:
+        start = self.number(request, "start")
+        end = self.number(request, "end")
+        if end <= start or end - start > MAX_EVENTS_SPAN:
+            raise web.HTTPBadRequest(text=f"at most {MAX_EVENTS_SPAN}s of events")
+        events = self.events.query(
+            datetime.fromtimestamp(start), datetime.fromtimestamp(end)
+        )
+        return web.json_response(
+            [
+                {
+                    "id": event.id,
+                    "kind": event.kind,
+                    "start": event.start.timestamp(),
+                    "end": event.end and event.end.timestamp(),
+                    "file": event.file,
+                }
+                for event in events
+            ],
+            headers={"Access-Control-Allow-Origin": "*"},
+        )
+
+    async def handle_sprite(self, request: web.Request) -> web.Response:
+        resolution = self.resolution(request)
+        offset = int(self.number(request, "offset", 0))
+        index = int(self.number(request, "index"))
+        key = (resolution, offset, index)
+        # the last bucket of the sprite is over (and its recordings closed) a minute after its end
+        end = (index + 1) * SPRITE_TILES * resolution - offset
+        complete = end < time.time() - 60
+        body = self.sprites.get(key)
+        if body is None:
+            async with self.decoding:
+                body = self.sprites.get(key)  # decoded while this request waited
+                if body is None:
+                    body = await asyncio.get_running_loop().run_in_executor(
+                        None, self.sprite, resolution, offset, index
+                    )
+            if complete:
+                self.sprites[key] = body
+                while len(self.sprites) > self.cache_size:
+                    self.sprites.popitem(last=False)
+        else:
+            self.sprites.move_to_end(key)
+        cache_control = "max-age=604800" if complete else "max-age=60"
+        return web.Response(
+            body=body,
+            content_type="image/jpeg",
+            headers={
+                "Cache-Control": cache_control,
+                "Access-Control-Allow-Origin": "*",
+            },
+        )
+
+    def sprite(self, resolution: int, offset: int, index: int) -> bytes:
+        first = index * SPRITE_TILES
+        start = first * resolution - offset
+        end = start + SPRITE_TILES * resolution
+        files: dict[int, str] = {}
+        for event in self.events.query(
+            datetime.fromtimestamp(start), datetime.fromtimestamp(end)
+        ):
+            bucket = int(event.start.timestamp() + offset) // resolution - first
+            if event.file is not None and 0 <= bucket < SPRITE_TILES:
+                files.setdefault(bucket, event.file)
+        width, height = TILE_SIZE
+        image = np.full((height, width * SPRITE_TILES, 3), 32, dtype=np.uint8)
+        for bucket, file in files.items():
+            tile = thumbnail_of(
+                self.folder / file
+            )  # None once the retention deleted it
+            if tile is not None:
+                image[:, bucket * width : (bucket + 1) * width] = tile
+        _LOGGER.debug(
+            f"Sprite {resolution}s #{index} with {len(files)} thumbnails at "
+            + datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        )
+        return encode_jpeg(image, 70)
@@ -6,16 +6,25 @@ import aiohttp
 from functools import cached_property
 import os
 import logging
+from logging import getLogger
 import sys
+from control_socket import call, is_running
 
 if "DEBUG" in os.environ:
 
     logging.basicConfig(stream=sys.stdout, level=logging.DEBUG)
 
+_LOGGER = getLogger(__name__)
+
 if __name__ == "__main__":
 
     @arguably.command
     def feed(*, plate: int = 1):
+        if is_running():
+            # the daemon uses its warm session and knows about it
+            print(call("feed", plate=plate))
+            return
+
         async def _feed(plate: int = 1):
             async with aiohttp.ClientSession() as session:
                 feeder = WetFoodFeeder(session)
@@ -26,6 +35,10 @@ if __name__ == "__main__":
 
     @arguably.command
     def close():
+        if is_running():
+            print(call("close"))
+            return
+
         async def _close():
             async with aiohttp.ClientSession() as session:
                 feeder = WetFoodFeeder(session)
@@ -34,6 +47,22 @@ if __name__ == "__main__":
 
         asyncio.run(_close())
 
+    @arguably.command
+    def status(*, concurrency: int = 4, deadline: float = 10):
+        """
+        print the details of every device of the account, fetched concurrently
+        """
+
+        async def _status():
+            async with aiohttp.ClientSession() as session:
+                feeder = WetFoodFeeder(session)
+                await feeder.login()
+                return await feeder.api.snapshot(
+                    concurrency=concurrency, deadline=deadline
+                )
+
+        print(json.dumps(asyncio.run(_status()), indent=2))
+
 
 class WetFoodFeeder:
     def __init__(self, session: aiohttp.ClientSession):
@@ -62,11 +91,43 @@ class WetFoodFeeder:
         assert hasattr(self, "deviceSn"), "please call `login` first"
         await self.api.set_manual_feed_now(self.deviceSn, plate)
 
+    async def prewarm(self) -> None:
+        # a cheap authenticated call that keeps the token and the pooled connection fresh for the next command
+        assert hasattr(self, "deviceSn"), "please call `login` first"
+        try:
+            await self.api.device_real_info(self.deviceSn)
+        except Exception as e:
+            _LOGGER.error(f"Failed to pre-warm the cloud session: {e}")
+
     async def stop_feed_now(self) -> None:
         assert hasattr(self, "deviceSn"), "please call `login` first"
         await self.api.set_stop_feed_now(self.deviceSn, 1)
 
 
+class SimulatedFeeder(WetFoodFeeder):
+    """
+    no cloud at all, for the end-to-end tests with `synthetic_camera.py`: the commands only take `latency` seconds
+    """
+
+    def __init__(self, session: aiohttp.ClientSession, latency: float = 0.5):
+        self.latency = latency
+
+    async def login(self) -> None:
+        self.devices = []
+        self.deviceSn = "simulated"
+
+    async def manual_feed_now(self, plate: int = 1) -> None:
+        await asyncio.sleep(self.latency)
+        _LOGGER.info(f"Simulated feeder opened plate {plate}")
+
+    async def prewarm(self) -> None:
+        pass
+
+    async def stop_feed_now(self) -> None:
+        await asyncio.sleep(self.latency)
+        _LOGGER.info("Simulated feeder closed")
+
+
 def find_wet_feeder(devices: list) -> dict:
     for device in devices:
         if device["productName"] == "Polar Wet Food Feeder":